@@ -0,0 +1,422 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "core/types.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if !defined(BFVM_BENCH_VM)
+#   define BFVM_BENCH_VM "bfvm"
+#endif
+
+#define BFVM_BENCH_DEFAULT_RUNS    5U
+#define BFVM_BENCH_DEFAULT_WARMUP  1U
+#define BFVM_BENCH_DEFAULT_TIMEOUT 300U
+
+#define BFVM_BENCH_MAX_ARGS    8
+#define BFVM_BENCH_ERRORS_SIZE 4096
+#define BFVM_BENCH_NULL_DEVICE "/dev/null"
+
+#define BFVM_BENCH_COUNT_SUFFIX " instructions dispatched"
+
+typedef struct BFBenchEngine
+{
+    const char *name;
+    const char *flag;
+} BFBenchEngine;
+
+typedef struct BFBenchOptions
+{
+    const char *vm;
+    const char *output;
+    unsigned    runs;
+    unsigned    warmup;
+    unsigned    timeout;
+} BFBenchOptions;
+
+typedef enum BFBenchStatus
+{
+    BFVM_BENCH_OK,
+    BFVM_BENCH_FAILED,
+    BFVM_BENCH_TIMEOUT
+} BFBenchStatus;
+
+/* one execution of the VM; peakRss is in KiB */
+typedef struct BFBenchRun
+{
+    BFBenchStatus status;
+    u64           wallNs;
+    u64           peakRss;
+} BFBenchRun;
+
+static const BFBenchEngine s_Engines[] = {
+    { "switch",   NULL         },
+    { "threaded", "--threaded" },
+    { "jit",      "--jit"      }
+};
+
+static const char *const s_Levels[] = { "-O0", "-O1", "-O2" };
+
+static BFBool bfvmBenchParseCount(const char *arg, unsigned *count, BFBool allowZero);
+static u64 bfvmBenchCountInstructions(const BFBenchOptions *options, const char *program, const char *level);
+static void bfvmBenchMeasure(FILE *out, const BFBenchOptions *options, const char *program, const char *level,
+                             const BFBenchEngine *engine, u64 instructions, BFBool first);
+static BFBenchRun bfvmBenchSpawn(const BFBenchOptions *options, const char *const *args, char *errors, size_t errorsSize);
+static int bfvmBenchCompareU64(const void *a, const void *b);
+static void bfvmBenchWriteString(FILE *out, const char *s);
+static const char *bfvmBenchStatusName(BFBenchStatus status);
+
+/*
+ * Runs every program under every optimization level and engine of the VM and
+ * writes wall time, instructions dispatched, ns per instruction and peak RSS
+ * as JSON. Each measurement is a fresh VM process whose output goes to
+ * /dev/null and whose input is empty, so terminal I/O never shows up in the
+ * timings. The instruction count comes from one extra run with --count.
+ */
+int main(int argc, char **argv)
+{
+    BFBenchOptions options = {
+        BFVM_BENCH_VM, NULL, BFVM_BENCH_DEFAULT_RUNS, BFVM_BENCH_DEFAULT_WARMUP, BFVM_BENCH_DEFAULT_TIMEOUT
+    };
+
+    int first = argc;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--vm=", 5) == 0)
+        {
+            options.vm = argv[i] + 5;
+        }
+        else if (strncmp(argv[i], "--output=", 9) == 0)
+        {
+            options.output = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--runs=", 7) == 0)
+        {
+            if (!bfvmBenchParseCount(argv[i] + 7, &options.runs, BF_FALSE))
+            {
+                fprintf(stderr, "bfvm-bench: invalid run count: %s\n", argv[i] + 7);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], "--warmup=", 9) == 0)
+        {
+            if (!bfvmBenchParseCount(argv[i] + 9, &options.warmup, BF_TRUE))
+            {
+                fprintf(stderr, "bfvm-bench: invalid warm-up count: %s\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strncmp(argv[i], "--timeout=", 10) == 0)
+        {
+            if (!bfvmBenchParseCount(argv[i] + 10, &options.timeout, BF_FALSE))
+            {
+                fprintf(stderr, "bfvm-bench: invalid timeout: %s\n", argv[i] + 10);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "bfvm-bench: unknown option: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        else
+        {
+            first = i;
+            break;
+        }
+    }
+
+    if (first == argc)
+    {
+        fprintf(stderr, "usage: bfvm-bench [--vm=<path>] [--runs=<n>] [--warmup=<n>] [--timeout=<seconds>] "
+                        "[--output=<file>] <program>...\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *const out = options.output ? fopen(options.output, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "bfvm-bench: could not open file: %s\n", options.output);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "{\n  \"vm\": ");
+    bfvmBenchWriteString(out, options.vm);
+    fprintf(out, ",\n  \"runs\": %u,\n  \"warmup\": %u,\n  \"results\": [", options.runs, options.warmup);
+
+    BFBool firstResult = BF_TRUE;
+    for (int i = first; i < argc; i++)
+    {
+        for (size_t level = 0; level < sizeof(s_Levels) / sizeof(s_Levels[0]); level++)
+        {
+            const u64 instructions = bfvmBenchCountInstructions(&options, argv[i], s_Levels[level]);
+            for (size_t engine = 0; engine < sizeof(s_Engines) / sizeof(s_Engines[0]); engine++)
+            {
+                bfvmBenchMeasure(out, &options, argv[i], s_Levels[level], &s_Engines[engine], instructions, firstResult);
+                firstResult = BF_FALSE;
+            }
+        }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    const BFBool written = !ferror(out);
+    if ((out != stdout && fclose(out) != 0) || !written)
+    {
+        fprintf(stderr, "bfvm-bench: could not write results\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static BFBool bfvmBenchParseCount(const char *arg, unsigned *count, BFBool allowZero)
+{
+    char *end = NULL;
+    const unsigned long value = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0' || value > 1000000UL || (value == 0 && !allowZero))
+    {
+        return BF_FALSE;
+    }
+
+    *count = (unsigned)value;
+    return BF_TRUE;
+}
+
+/* the VM reports the count as its last line on stderr; 0 means it could not be counted */
+static u64 bfvmBenchCountInstructions(const BFBenchOptions *options, const char *program, const char *level)
+{
+    const char *const args[] = { options->vm, "--count", level, program, NULL };
+
+    char errors[BFVM_BENCH_ERRORS_SIZE];
+    const BFBenchRun run = bfvmBenchSpawn(options, args, errors, sizeof(errors));
+    const char *const suffix = strstr(errors, BFVM_BENCH_COUNT_SUFFIX);
+    if (run.status != BFVM_BENCH_OK || !suffix)
+    {
+        return 0;
+    }
+
+    const char *digits = suffix;
+    while (digits > errors && digits[-1] >= '0' && digits[-1] <= '9')
+    {
+        digits--;
+    }
+
+    return strtoull(digits, NULL, 10);
+}
+
+static void bfvmBenchMeasure(FILE *out, const BFBenchOptions *options, const char *program, const char *level,
+                             const BFBenchEngine *engine, u64 instructions, BFBool first)
+{
+    const char *args[BFVM_BENCH_MAX_ARGS] = { options->vm, level };
+    size_t argCount = 2;
+    if (engine->flag)
+    {
+        args[argCount++] = engine->flag;
+    }
+
+    args[argCount++] = program;
+    args[argCount] = NULL;
+
+    u64 *const times = (u64 *)malloc(sizeof(u64) * options->runs);
+    if (!times)
+    {
+        fprintf(stderr, "bfvm-bench: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    BFBenchRun run = { BFVM_BENCH_OK, 0, 0 };
+    u64 peakRss = 0;
+    for (unsigned i = 0; i < options->warmup + options->runs && run.status == BFVM_BENCH_OK; i++)
+    {
+        run = bfvmBenchSpawn(options, args, NULL, 0);
+        if (i >= options->warmup)
+        {
+            times[i - options->warmup] = run.wallNs;
+            peakRss = (run.peakRss > peakRss) ? run.peakRss : peakRss;
+        }
+    }
+
+    fprintf(out, first ? "\n    {\n" : ",\n    {\n");
+    fprintf(out, "      \"program\": ");
+    bfvmBenchWriteString(out, program);
+    fprintf(out, ",\n      \"level\": \"%s\",\n      \"engine\": \"%s\",\n", level, engine->name);
+    fprintf(out, "      \"status\": \"%s\",\n", bfvmBenchStatusName(run.status));
+    fprintf(out, "      \"instructions\": %llu", (unsigned long long)instructions);
+
+    if (run.status == BFVM_BENCH_OK)
+    {
+        qsort(times, options->runs, sizeof(u64), bfvmBenchCompareU64);
+
+        u64 total = 0;
+        for (unsigned i = 0; i < options->runs; i++)
+        {
+            total += times[i];
+        }
+
+        fprintf(out, ",\n      \"wall_ns\": { \"min\": %llu, \"median\": %llu, \"mean\": %llu }",
+                (unsigned long long)times[0],
+                (unsigned long long)times[options->runs / 2],
+                (unsigned long long)(total / options->runs));
+
+        if (instructions > 0)
+        {
+            fprintf(out, ",\n      \"ns_per_op\": %.3f", (double)times[0] / (double)instructions);
+        }
+
+        fprintf(out, ",\n      \"peak_rss_kib\": %llu", (unsigned long long)peakRss);
+        fprintf(stderr, "%s %s %s: %.3f s\n", program, level, engine->name, (double)times[0] / 1e9);
+    }
+    else
+    {
+        fprintf(stderr, "%s %s %s: %s\n", program, level, engine->name, bfvmBenchStatusName(run.status));
+    }
+
+    fprintf(out, "\n    }");
+    free(times);
+}
+
+/*
+ * Runs the VM with stdin and stdout on the null device. The timeout is an
+ * alarm set in the child, which survives the exec and kills the VM. If errors
+ * is given, it receives the tail of whatever the VM wrote to stderr.
+ */
+static BFBenchRun bfvmBenchSpawn(const BFBenchOptions *options, const char *const *args, char *errors, size_t errorsSize)
+{
+    BFBenchRun run = { BFVM_BENCH_FAILED, 0, 0 };
+
+    int pipeFds[2] = { -1, -1 };
+    if (errors && pipe(pipeFds) != 0)
+    {
+        return run;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        const int sink = open(BFVM_BENCH_NULL_DEVICE, O_RDWR);
+        dup2(sink, STDIN_FILENO);
+        dup2(sink, STDOUT_FILENO);
+        dup2(errors ? pipeFds[1] : sink, STDERR_FILENO);
+
+        alarm(options->timeout);
+        execv(args[0], (char *const *)args);
+        _exit(127);
+    }
+
+    size_t length = 0;
+    if (errors)
+    {
+        close(pipeFds[1]);
+
+        char chunk[BFVM_BENCH_ERRORS_SIZE];
+        ssize_t count = 0;
+        while ((count = read(pipeFds[0], chunk, sizeof(chunk))) > 0)
+        {
+            /* only the tail matters, so earlier output is dropped once the buffer is full */
+            const size_t keep = ((size_t)count < errorsSize - 1) ? (size_t)count : errorsSize - 1;
+            if (length + keep > errorsSize - 1)
+            {
+                const size_t drop = length + keep - (errorsSize - 1);
+                memmove(errors, errors + drop, length - drop);
+                length -= drop;
+            }
+
+            memcpy(errors + length, chunk + ((size_t)count - keep), keep);
+            length += keep;
+        }
+
+        close(pipeFds[0]);
+        errors[length] = '\0';
+    }
+
+    if (pid < 0)
+    {
+        return run;
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+    {
+        return run;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    run.wallNs = (u64)(end.tv_sec - start.tv_sec) * 1000000000ULL + (u64)end.tv_nsec - (u64)start.tv_nsec;
+
+#if defined(__APPLE__)
+    run.peakRss = (u64)usage.ru_maxrss / 1024;
+#else
+    run.peakRss = (u64)usage.ru_maxrss;
+#endif
+
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM)
+    {
+        run.status = BFVM_BENCH_TIMEOUT;
+    }
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        run.status = BFVM_BENCH_OK;
+    }
+
+    return run;
+}
+
+static int bfvmBenchCompareU64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a;
+    const u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+static void bfvmBenchWriteString(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++)
+    {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+        {
+            fprintf(out, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(out, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static const char *bfvmBenchStatusName(BFBenchStatus status)
+{
+    switch (status)
+    {
+        case BFVM_BENCH_OK:
+            return "ok";
+        case BFVM_BENCH_TIMEOUT:
+            return "timeout";
+        default:
+            return "failed";
+    }
+}
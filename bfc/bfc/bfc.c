@@ -1,30 +1,53 @@
 #include "bfc.h"
 
+#include "core/clock.h"
 #include "core/error.h"
 #include "core/memory.h"
 
+#include "bytecode/bytecode.h"
+#include "bytecode/image.h"
+#include "emitter/emitter.h"
+#include "evaluator/evaluator.h"
+#include "ir/ir.h"
 #include "lexer/lexer.h"
+#include "optimizer/passes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(BFC_PLATFORM_WINDOWS)
+#   include <direct.h>
+#   define BFC_MKDIR(PATH) _mkdir(PATH)
+#else
+#   include <sys/stat.h>
+#   define BFC_MKDIR(PATH) mkdir(PATH, 0777)
+#endif
 
 #define INIT_CODE_SIZE 32UL
+#define INIT_LOOP_SIZE 32UL
 
-#define PARSE_CHAIN(TOKEN, INSTR, OFFSET)                   \
-    bfcEnsureCodeSpace(compiler);                           \
-    compiler->code[compiler->pos].instr = INSTR;            \
-    OFFSET = 0;                                             \
-    while (compiler->currToken == TOKEN)                    \
-    {                                                       \
-        OFFSET++;                                           \
-        compiler->currToken = bfcNextToken(compiler->lexer);\
-    }                                                       \
-    compiler->pos++                                         \
+/* a '[' still waiting for its ']', as the loop node at index node of block */
+typedef struct BFOpenLoop
+{
+    BFBlock         *block;
+    size_t           node;
+    BFSourcePosition srcPos;
+} BFOpenLoop;
 
+/* block is where the parser appends nodes, the body of the innermost open loop */
 typedef struct BFCompiler
 {
-    BFLexer  *lexer;
-    BFOpCode *code;
-    size_t    pos;
-    size_t    size;
-    BFToken   currToken;
+    BFLexer         *lexer;
+    BFIrProgram     *ir;
+    BFBlock         *block;
+    BFOpenLoop      *loops;
+    size_t           loopDepth;
+    size_t           loopSize;
+    BFToken          currToken;
+    BFCompileStatus  status;
+    u32              cellMask;
 } BFCompiler;
 
 static void bfcParseProgram(BFCompiler *compiler);
@@ -34,32 +57,283 @@ static void bfcParseAddPtr(BFCompiler *compiler);
 static void bfcParseSubPtr(BFCompiler *compiler);
 static void bfcParseWrite(BFCompiler *compiler);
 static void bfcParseRead(BFCompiler *compiler);
-static void bfcParseConditional(BFCompiler *compiler);
+static void bfcParseLoopOpen(BFCompiler *compiler);
+static void bfcParseLoopClose(BFCompiler *compiler);
+static void bfcParseChain(BFCompiler *compiler, BFToken token, BFNodeKind kind, BFBool negate);
+
+static BFNode *bfcEmitNode(BFCompiler *compiler, BFNodeKind kind, size_t source);
+static void bfcDefer(BFCompiler *compiler, BFCompileStatus status);
+
+static BFProgram *bfcCompileLexer(BFLexer *lexer, const BFCompileOptions *options, BFCompileStatus *status);
+static BFBool bfcMeasureProgram(BFProgram *program);
+static BFBool bfcLocateProgram(BFProgram *program, const BFLexer *lexer, const size_t *sources);
+static void bfcClearPrefix(BFProgram *program);
 
-static void bfcEnsureCodeSpace(BFCompiler *compiler);
-static void bfcDefer(BFCompiler *compiler);
+static BFProgram *bfcMapProgram(const char *filepath, const u64 *key);
+static char *bfcCachePath(const char *cacheDir, u64 key);
+static BFBool bfcMakeDirectory(const char *path);
 
-const BFOpCode *bfcCompile(const char *filepath)
+BFProgram *bfcCompile(const char *filepath, const BFCompileOptions *options, BFCompileStatus *status)
 {
+    BFCompileStatus ignored = BFC_COMPILE_OK;
+    if (!status)
+    {
+        status = &ignored;
+    }
+
     BFLexer *const lexer = bfcInitLexer(filepath);
     if (!lexer)
     {
+        *status = BFC_COMPILE_IO_ERROR;
         return NULL;
     }
 
-    BFCompiler *const compiler = BFC_MALLOC(BFCompiler, 1);
-    compiler->lexer = lexer;
-    compiler->code = BFC_MALLOC(BFOpCode, INIT_CODE_SIZE);
-    compiler->pos = 0;
-    compiler->size = INIT_CODE_SIZE;
+    return bfcCompileLexer(lexer, options, status);
+}
+
+BFProgram *bfcCompileSource(const char *name, const char *source, size_t size, const BFCompileOptions *options, BFCompileStatus *status)
+{
+    BFCompileStatus ignored = BFC_COMPILE_OK;
+    if (!status)
+    {
+        status = &ignored;
+    }
+
+    return bfcCompileLexer(bfcInitLexerFromMemory(name, (const u8 *)source, size), options, status);
+}
+
+void bfcFreeProgram(BFProgram *program)
+{
+    if (program->image)
+    {
+        bfcUnmapImage(program->image, program->imageSize);
+    }
+    else
+    {
+        BFC_FREE(program->code);
+        BFC_FREE(program->prefixTape);
+        BFC_FREE(program->prefixOutput);
+    }
+
+    BFC_FREE(program->positions);
+    BFC_FREE(program);
+}
+
+BFProgram *bfcLoadProgram(const char *filepath, BFCompileStatus *status)
+{
+    BFCompileStatus ignored = BFC_COMPILE_OK;
+    if (!status)
+    {
+        status = &ignored;
+    }
+
+    BFProgram *const program = bfcMapProgram(filepath, NULL);
+    if (!program)
+    {
+        bfcPrintError("not a valid bytecode image: %s", filepath);
+        *status = BFC_COMPILE_INVALID_BYTECODE;
+        return NULL;
+    }
+
+    *status = BFC_COMPILE_OK;
+    return program;
+}
+
+BFBool bfcSaveProgram(const BFProgram *program, const char *filepath)
+{
+    if (!bfcWriteImage(program, 0, filepath))
+    {
+        bfcPrintError("could not write bytecode image: %s", filepath);
+        return BFC_FALSE;
+    }
+
+    return BFC_TRUE;
+}
 
-    bfcParseProgram(compiler);
-    BFOpCode *const code = compiler->code;
+BFBool bfcEmitC(const BFProgram *program, const char *programName, const char *filepath)
+{
+    FILE *const file = fopen(filepath, "w");
+    if (!file)
+    {
+        bfcPrintError("could not open file: %s", filepath);
+        return BFC_FALSE;
+    }
 
-    bfcCloseLexer(compiler->lexer);
-    BFC_FREE(compiler);
+    const BFBool written = bfcWriteC(program, programName, file);
+    if (fclose(file) != 0 || !written)
+    {
+        bfcPrintError("could not write C source: %s", filepath);
+        remove(filepath);
+        return BFC_FALSE;
+    }
 
-    return code;
+    return BFC_TRUE;
+}
+
+/*
+ * Both entry points end up here. The lexer is closed before returning, on
+ * success and failure alike.
+ */
+static BFProgram *bfcCompileLexer(BFLexer *lexer, const BFCompileOptions *options, BFCompileStatus *status)
+{
+    static const BFCompileOptions defaults = { BFC_OPT_PEEPHOLE, BFC_DEFAULT_CELL_BITS, NULL, BFC_FALSE, BFC_DEFAULT_PREFIX_STEPS, NULL };
+
+    if (!lexer)
+    {
+        *status = BFC_COMPILE_IO_ERROR;
+        return NULL;
+    }
+
+    if (!options)
+    {
+        options = &defaults;
+    }
+
+    if (options->cellBits != 8 && options->cellBits != 16 && options->cellBits != 32)
+    {
+        bfcPrintError("unsupported cell width: %u bits", (unsigned)options->cellBits);
+        bfcCloseLexer(lexer);
+        *status = BFC_COMPILE_INVALID_OPTIONS;
+        return NULL;
+    }
+
+    const char *const name = bfcGetProgramName(lexer);
+    const u32 cellMask = (u32)(((u64)1 << options->cellBits) - 1);
+
+    BFCompileReport *const report = options->report;
+    if (report)
+    {
+        report->count = 0;
+    }
+
+    const BFBool useCache = options->cacheDir && options->cacheDir[0] != '\0' && !options->sourceMap && !report;
+    const u64 key = useCache ? bfcImageKey(bfcGetSource(lexer), bfcGetSourceSize(lexer), options) : 0;
+    if (useCache)
+    {
+        char *const cachePath = bfcCachePath(options->cacheDir, key);
+        BFProgram *const cached = bfcMapProgram(cachePath, &key);
+        BFC_FREE(cachePath);
+
+        if (cached)
+        {
+            bfcCloseLexer(lexer);
+            *status = BFC_COMPILE_OK;
+            return cached;
+        }
+    }
+
+    u64 start = bfcNow();
+
+    BFCompiler compiler;
+    compiler.lexer = lexer;
+    compiler.ir = bfcCreateIr(cellMask);
+    compiler.block = compiler.ir ? compiler.ir->body : NULL;
+    compiler.loops = BFC_TRY_MALLOC(BFOpenLoop, INIT_LOOP_SIZE);
+    compiler.loopDepth = 0;
+    compiler.loopSize = INIT_LOOP_SIZE;
+    compiler.status = BFC_COMPILE_OK;
+    compiler.cellMask = cellMask;
+
+    if (!compiler.ir || !compiler.loops)
+    {
+        bfcDefer(&compiler, BFC_COMPILE_OUT_OF_MEMORY);
+    }
+
+    bfcParseProgram(&compiler);
+    BFIrProgram *const ir = compiler.ir;
+    *status = compiler.status;
+
+    BFC_FREE(compiler.loops);
+
+    if (!ir)
+    {
+        if (*status == BFC_COMPILE_OUT_OF_MEMORY)
+        {
+            bfcPrintError("out of memory while compiling %s", name);
+        }
+
+        bfcCloseLexer(lexer);
+        return NULL;
+    }
+
+    if (report)
+    {
+        const u64 elapsed = bfcNow() - start;
+        bfcReportStage(report, "parse", elapsed, bfcCountNodes(ir));
+    }
+
+    BFPassManager manager;
+    const BFBool ready = bfcInitPassManager(&manager);
+    BFC_ASSERT(ready, "the standard passes do not fit in the pass manager");
+
+    if (!ready || !bfcRunPasses(&manager, ir, options->level, report))
+    {
+        bfcPrintError("out of memory while compiling %s", name);
+        bfcFreeIr(ir);
+        bfcCloseLexer(lexer);
+        *status = BFC_COMPILE_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    start = bfcNow();
+
+    BFInstruction *const code = bfcLowerProgram(ir);
+    bfcFreeIr(ir);
+
+    size_t *sources = NULL;
+    BFOpCode *const words = code ? bfcEncodeProgram(code, options->sourceMap ? &sources : NULL) : NULL;
+    BFC_FREE(code);
+
+    BFProgram *const program = words ? BFC_TRY_MALLOC(BFProgram, 1) : NULL;
+    if (program)
+    {
+        program->code = words;
+        program->cellBits = options->cellBits;
+        program->image = NULL;
+        program->imageSize = 0;
+        program->positions = NULL;
+        bfcClearPrefix(program);
+    }
+
+    if (!program || !bfcMeasureProgram(program) || !bfcLocateProgram(program, lexer, sources))
+    {
+        bfcPrintError("out of memory while compiling %s", name);
+        if (program)
+        {
+            bfcFreeProgram(program);
+        }
+        else
+        {
+            BFC_FREE(words);
+        }
+
+        BFC_FREE(sources);
+        bfcCloseLexer(lexer);
+        *status = BFC_COMPILE_OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    BFC_FREE(sources);
+    bfcReportStage(report, "lower", bfcNow() - start, program->instrCount);
+
+    if (options->level >= BFC_OPT_PEEPHOLE && options->prefixSteps > 0)
+    {
+        start = bfcNow();
+        bfcEvaluatePrefix(program, options->prefixSteps);
+        bfcReportStage(report, "prefix", bfcNow() - start, program->instrCount);
+    }
+
+    bfcCloseLexer(lexer);
+
+    /* the cache is only an optimization, so failing to fill it is not an error */
+    if (useCache && bfcMakeDirectory(options->cacheDir))
+    {
+        char *const cachePath = bfcCachePath(options->cacheDir, key);
+        bfcWriteImage(program, key, cachePath);
+        BFC_FREE(cachePath);
+    }
+
+    return program;
 }
 
 /* --- parser routines ------------------------------------------------------*/
@@ -67,7 +341,7 @@ const BFOpCode *bfcCompile(const char *filepath)
 static void bfcParseProgram(BFCompiler *compiler)
 {
     compiler->currToken = bfcNextToken(compiler->lexer);
-    while (compiler->currToken != TOK_EOF)
+    while (compiler->ir && compiler->currToken != TOK_EOF)
     {
         switch (compiler->currToken)
         {
@@ -90,169 +364,480 @@ static void bfcParseProgram(BFCompiler *compiler)
                 bfcParseRead(compiler);
                 break;
             case TOK_BRACE_LEFT:
-                bfcParseConditional(compiler);
+                bfcParseLoopOpen(compiler);
+                break;
+            case TOK_BRACE_RIGHT:
+                bfcParseLoopClose(compiler);
                 break;
             default:
             {
                 const char *const progName = bfcGetProgramName(compiler->lexer);
                 const BFSourcePosition pos = bfcGetCurrentSourcePosition(compiler->lexer);
                 bfcPrintErrorPos(progName, pos.line, pos.column, "unknown token: %c", (char)compiler->currToken);
-                bfcDefer(compiler);
+                bfcDefer(compiler, BFC_COMPILE_SYNTAX_ERROR);
             } return;
         }
     }
 
-    if (!compiler->code)
+    if (!compiler->ir)
+    {
+        return;
+    }
+
+    /* the innermost unclosed loop is the one reported, as it is the first to run into the end */
+    if (compiler->loopDepth > 0)
     {
+        const char *const progName = bfcGetProgramName(compiler->lexer);
+        const BFSourcePosition pos = compiler->loops[compiler->loopDepth - 1].srcPos;
+        bfcPrintErrorPos(progName, pos.line, pos.column, "no matching ']'");
+        bfcDefer(compiler, BFC_COMPILE_SYNTAX_ERROR);
         return;
     }
 
-    bfcEnsureCodeSpace(compiler);
-    compiler->code[compiler->pos].instr = BFC_END;
+    compiler->ir->endSource = bfcGetTokenOffset(compiler->lexer);
 }
 
 static void bfcParseAddByte(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    PARSE_CHAIN(TOK_ADD, BFC_ADDB, compiler->code[compiler->pos].operands.byteOffset);
+    bfcParseChain(compiler, TOK_ADD, BFC_NODE_ADD, BFC_FALSE);
 }
 
 static void bfcParseSubByte(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    PARSE_CHAIN(TOK_SUB, BFC_SUBB, compiler->code[compiler->pos].operands.byteOffset);
+    bfcParseChain(compiler, TOK_SUB, BFC_NODE_ADD, BFC_TRUE);
 }
 
 static void bfcParseAddPtr(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    PARSE_CHAIN(TOK_ARROW_RIGHT, BFC_ADDP, compiler->code[compiler->pos].operands.dataOffset);
+    bfcParseChain(compiler, TOK_ARROW_RIGHT, BFC_NODE_MOVE, BFC_FALSE);
 }
 
 static void bfcParseSubPtr(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    PARSE_CHAIN(TOK_ARROW_LEFT, BFC_SUBP, compiler->code[compiler->pos].operands.dataOffset);
+    bfcParseChain(compiler, TOK_ARROW_LEFT, BFC_NODE_MOVE, BFC_TRUE);
 }
 
 static void bfcParseWrite(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    bfcEnsureCodeSpace(compiler);
-
-    compiler->code[compiler->pos++].instr = BFC_WRITE;
-    compiler->currToken = bfcNextToken(compiler->lexer);
+    bfcParseChain(compiler, TOK_DOT, BFC_NODE_WRITE, BFC_FALSE);
 }
 
 static void bfcParseRead(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    bfcEnsureCodeSpace(compiler);
+    if (!bfcEmitNode(compiler, BFC_NODE_READ, bfcGetTokenOffset(compiler->lexer)))
+    {
+        return;
+    }
 
-    compiler->code[compiler->pos++].instr = BFC_READ;
     compiler->currToken = bfcNextToken(compiler->lexer);
 }
 
-static void bfcParseConditional(BFCompiler *compiler)
+/*
+ * Loops are matched with an explicit stack of open brackets rather than by
+ * recursion, so nesting depth is bounded by memory, not by the C stack.
+ */
+static void bfcParseLoopOpen(BFCompiler *compiler)
 {
-    if (!compiler->code)
+    if (!compiler->ir)
     {
         return;
     }
 
-    const size_t openPos = compiler->pos;
-    const BFSourcePosition openSrcPos = bfcGetCurrentSourcePosition(compiler->lexer);
+    /* the stack grows first, so a loop node never exists without its body */
+    if (compiler->loopDepth >= compiler->loopSize)
+    {
+        const size_t loopSize = compiler->loopSize + (compiler->loopSize / 2);
+        BFOpenLoop *const loops = BFC_TRY_REALLOC(BFOpenLoop, compiler->loops, loopSize);
+        if (!loops)
+        {
+            bfcDefer(compiler, BFC_COMPILE_OUT_OF_MEMORY);
+            return;
+        }
 
-    bfcEnsureCodeSpace(compiler);
-    compiler->code[compiler->pos++].instr = BFC_JZ;
+        compiler->loops = loops;
+        compiler->loopSize = loopSize;
+    }
 
+    BFNode *const loop = bfcEmitNode(compiler, BFC_NODE_LOOP, bfcGetTokenOffset(compiler->lexer));
+    if (!loop)
+    {
+        return;
+    }
+
+    compiler->loops[compiler->loopDepth].block = compiler->block;
+    compiler->loops[compiler->loopDepth].node = compiler->block->count - 1;
+    compiler->loops[compiler->loopDepth++].srcPos = bfcGetCurrentSourcePosition(compiler->lexer);
+
+    loop->as.loop.body = bfcCreateBlock();
+    if (!loop->as.loop.body)
+    {
+        bfcDefer(compiler, BFC_COMPILE_OUT_OF_MEMORY);
+        return;
+    }
+
+    compiler->block = loop->as.loop.body;
     compiler->currToken = bfcNextToken(compiler->lexer);
-    while (compiler->currToken != TOK_BRACE_RIGHT)
+}
+
+static void bfcParseLoopClose(BFCompiler *compiler)
+{
+    if (!compiler->ir)
     {
-        switch (compiler->currToken)
+        return;
+    }
+
+    if (compiler->loopDepth == 0)
+    {
+        const char *const progName = bfcGetProgramName(compiler->lexer);
+        const BFSourcePosition pos = bfcGetCurrentSourcePosition(compiler->lexer);
+        bfcPrintErrorPos(progName, pos.line, pos.column, "no matching '['");
+        bfcDefer(compiler, BFC_COMPILE_SYNTAX_ERROR);
+        return;
+    }
+
+    const BFOpenLoop *const open = &compiler->loops[--compiler->loopDepth];
+    open->block->nodes[open->node].as.loop.closeSource = bfcGetTokenOffset(compiler->lexer);
+    compiler->block = open->block;
+    compiler->currToken = bfcNextToken(compiler->lexer);
+}
+
+/*
+ * Collapses a run of one token into a single node. Byte runs reduce modulo
+ * the cell width and vanish when they wrap to zero, and negate turns a run
+ * of '-' or '<' into its negative amount. Mixed runs such as "++-" or "><<"
+ * are merged afterwards by the fold pass.
+ */
+static void bfcParseChain(BFCompiler *compiler, BFToken token, BFNodeKind kind, BFBool negate)
+{
+    const size_t source = bfcGetTokenOffset(compiler->lexer);
+    u64 count = 0;
+    while (compiler->currToken == token)
+    {
+        count++;
+        compiler->currToken = bfcNextToken(compiler->lexer);
+    }
+
+    if (kind == BFC_NODE_MOVE)
+    {
+        BFNode *const node = bfcEmitNode(compiler, kind, source);
+        if (node)
         {
-            case TOK_ADD:
-                bfcParseAddByte(compiler);
+            node->as.move = negate ? -(i64)count : (i64)count;
+        }
+        return;
+    }
+
+    if (kind == BFC_NODE_ADD)
+    {
+        const u32 value = (u32)((negate ? (u64)0 - count : count) & compiler->cellMask);
+        BFNode *const node = (value != 0) ? bfcEmitNode(compiler, kind, source) : NULL;
+        if (node)
+        {
+            node->as.cell.offset = 0;
+            node->as.cell.value = value;
+        }
+        return;
+    }
+
+    /* a repeat count only has to be split where it outgrows 32 bits */
+    while (count > 0)
+    {
+        const u32 repeat = (count > UINT32_MAX) ? UINT32_MAX : (u32)count;
+        BFNode *const node = bfcEmitNode(compiler, kind, source);
+        if (!node)
+        {
+            return;
+        }
+
+        node->as.cell.offset = 0;
+        node->as.cell.value = repeat;
+        count -= repeat;
+    }
+}
+
+/* appends a node to the current block, or gives up the whole program if it cannot grow */
+static BFNode *bfcEmitNode(BFCompiler *compiler, BFNodeKind kind, size_t source)
+{
+    BFNode *const node = bfcAppendNode(compiler->block, kind, source);
+    if (!node)
+    {
+        bfcDefer(compiler, BFC_COMPILE_OUT_OF_MEMORY);
+    }
+
+    return node;
+}
+
+static void bfcDefer(BFCompiler *compiler, BFCompileStatus status)
+{
+    bfcFreeIr(compiler->ir);
+    compiler->ir = NULL;
+    compiler->block = NULL;
+    compiler->status = status;
+}
+
+/* --- program metadata -----------------------------------------------------*/
+
+/* returns BFC_FALSE if the loop stack cannot grow */
+static BFBool bfcMeasureProgram(BFProgram *program)
+{
+    const BFOpCode *const code = program->code;
+
+    program->size = 0;
+    program->instrCount = 0;
+    program->loopCount = 0;
+    program->minOffset = 0;
+    program->maxOffset = 0;
+    program->reach = 0;
+    program->bounded = BFC_TRUE;
+
+    i64 *loopOffsets = BFC_TRY_MALLOC(i64, INIT_CODE_SIZE);
+    if (!loopOffsets)
+    {
+        return BFC_FALSE;
+    }
+
+    size_t loopSize = INIT_CODE_SIZE;
+    size_t depth = 0;
+    i64 offset = 0;
+    size_t drift = 0;
+
+#define TOUCH(CELL)                                                 \
+    if ((CELL) < program->minOffset) program->minOffset = (CELL);   \
+    if ((CELL) > program->maxOffset) program->maxOffset = (CELL)    \
+
+#define REACH(OFFSET)                                               \
+    if (drift + (size_t)labs(OFFSET) > program->reach)              \
+    {                                                               \
+        program->reach = drift + (size_t)labs(OFFSET);              \
+    }                                                               \
+
+    size_t ip = 0;
+    while (BFC_INSTR(code[ip]) != BFC_END)
+    {
+        const BFOpCode op = code[ip];
+        switch (BFC_INSTR(op))
+        {
+            case BFC_ADDB:
+            case BFC_SUBB:
+            case BFC_SET:
+            case BFC_WRITE:
+            case BFC_READ:
+                TOUCH(offset + BFC_OFFSET(op));
+                REACH(BFC_OFFSET(op));
                 break;
-            case TOK_SUB:
-                bfcParseSubByte(compiler);
+            case BFC_ADDP:
+                offset += BFC_OPERAND(op);
+                drift += BFC_OPERAND(op);
                 break;
-            case TOK_ARROW_RIGHT:
-                bfcParseAddPtr(compiler);
+            case BFC_SUBP:
+                offset -= BFC_OPERAND(op);
+                drift += BFC_OPERAND(op);
                 break;
-            case TOK_ARROW_LEFT:
-                bfcParseSubPtr(compiler);
+            case BFC_MUL:
+                TOUCH(offset + BFC_OFFSET(op));
+                TOUCH(offset + BFC_MUL_TARGET(code, ip));
+                REACH(BFC_OFFSET(op));
+                REACH(BFC_MUL_TARGET(code, ip));
                 break;
-            case TOK_DOT:
-                bfcParseWrite(compiler);
+            case BFC_SCAN:
+                program->bounded = BFC_FALSE;
+                REACH(0);
+                REACH(BFC_OFFSET(op));
+                drift = 0;
                 break;
-            case TOK_COMMA:
-                bfcParseRead(compiler);
+            case BFC_JZ:
+                REACH(0);
+                drift = 0;
+
+                if (depth >= loopSize)
+                {
+                    i64 *const grown = BFC_TRY_REALLOC(i64, loopOffsets, loopSize + (loopSize / 2));
+                    if (!grown)
+                    {
+                        BFC_FREE(loopOffsets);
+                        return BFC_FALSE;
+                    }
+
+                    loopOffsets = grown;
+                    loopSize = loopSize + (loopSize / 2);
+                }
+
+                loopOffsets[depth++] = offset;
+                program->loopCount++;
                 break;
-            case TOK_BRACE_LEFT:
-                bfcParseConditional(compiler);
+            case BFC_JNZ:
+                REACH(0);
+                drift = 0;
+                if (loopOffsets[--depth] != offset)
+                {
+                    program->bounded = BFC_FALSE;
+                }
                 break;
-            case TOK_EOF:
-            {
-                const char *const progName = bfcGetProgramName(compiler->lexer);
-                bfcPrintErrorPos(progName, openSrcPos.line, openSrcPos.column, "no matching ']'");
-                bfcDefer(compiler);
-            } return;
             default:
-            {
-                const char *const progName = bfcGetProgramName(compiler->lexer);
-                const BFSourcePosition pos = bfcGetCurrentSourcePosition(compiler->lexer);
-                bfcPrintErrorPos(progName, pos.line, pos.column, "unknown token: %c", (char)compiler->currToken);
-                bfcDefer(compiler);
-            } return;
+                break;
         }
+
+        TOUCH(offset);
+        program->instrCount++;
+        ip += BFC_WIDTH(op);
     }
 
-    compiler->currToken = bfcNextToken(compiler->lexer);
-    compiler->code[openPos].operands.instrLine = compiler->pos + 1;
+#undef REACH
+#undef TOUCH
 
-    bfcEnsureCodeSpace(compiler);
-    compiler->code[compiler->pos].instr = BFC_JMP;
-    compiler->code[compiler->pos++].operands.instrLine = openPos;
+    program->size = ip;
+    BFC_FREE(loopOffsets);
+    return BFC_TRUE;
 }
 
-static void bfcEnsureCodeSpace(BFCompiler *compiler)
+/* gives every word its source position if the encoder recorded source offsets */
+static BFBool bfcLocateProgram(BFProgram *program, const BFLexer *lexer, const size_t *sources)
 {
-    if (compiler->pos < compiler->size)
+    if (!sources)
     {
-        return;
+        return BFC_TRUE;
     }
 
-    compiler->size = compiler->size + (compiler->size / 2);
-    compiler->code = BFC_REALLOC(BFOpCode, compiler->code, compiler->size);
+    program->positions = BFC_TRY_MALLOC(BFSourcePosition, program->size + 1);
+    return (program->positions && bfcLocateSources(lexer, sources, program->size + 1, program->positions)) ? BFC_TRUE : BFC_FALSE;
+}
+
+static void bfcClearPrefix(BFProgram *program)
+{
+    program->prefixIp = 0;
+    program->prefixDp = 0;
+    program->prefixSpan = 0;
+    program->prefixEdges = 0;
+    program->prefixTape = NULL;
+    program->prefixCells = 0;
+    program->prefixOutput = NULL;
+    program->prefixOutputSize = 0;
 }
 
-static void bfcDefer(BFCompiler *compiler)
+/* --- bytecode images ------------------------------------------------------*/
+
+/*
+ * Maps an image and checks its code and prefix before anything runs it. The
+ * header only supplies sizes and the cell width; everything the engines rely
+ * on for safety, such as reach and boundedness, is measured from the code
+ * again.
+ */
+static BFProgram *bfcMapProgram(const char *filepath, const u64 *key)
 {
-    BFC_FREE(compiler->code);
-    compiler->code = NULL;
+    BFImageHeader header;
+    void *image = NULL;
+    size_t imageSize = 0;
+
+    BFOpCode *const code = bfcMapImage(filepath, &header, &image, &imageSize);
+    if (!code)
+    {
+        return NULL;
+    }
+
+    if ((key && header.key != *key) || !bfcVerifyProgram(code, (size_t)header.size, header.cellBits))
+    {
+        bfcUnmapImage(image, imageSize);
+        return NULL;
+    }
+
+    BFProgram *const program = BFC_TRY_MALLOC(BFProgram, 1);
+    if (!program)
+    {
+        bfcUnmapImage(image, imageSize);
+        return NULL;
+    }
+
+    program->code = code;
+    program->cellBits = header.cellBits;
+    program->image = image;
+    program->imageSize = imageSize;
+    program->positions = NULL;
+    if (!bfcMeasureProgram(program))
+    {
+        bfcFreeProgram(program);
+        return NULL;
+    }
+
+    program->prefixIp = (size_t)header.prefixIp;
+    program->prefixDp = (size_t)header.prefixDp;
+    program->prefixSpan = (size_t)header.prefixSpan;
+    program->prefixEdges = header.prefixEdges;
+    program->prefixTape = (u8 *)(code + header.size + 1);
+    program->prefixCells = (size_t)header.prefixCells;
+    program->prefixOutput = program->prefixTape + (program->prefixCells * (program->cellBits / 8));
+    program->prefixOutputSize = (size_t)header.prefixOutput;
+
+    if (!bfcVerifyPrefix(program))
+    {
+        bfcFreeProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+static char *bfcCachePath(const char *cacheDir, u64 key)
+{
+    const size_t length = strlen(cacheDir) + 32;
+    char *const path = BFC_MALLOC(char, length);
+    snprintf(path, length, "%s/%016llx" BFC_BYTECODE_EXTENSION, cacheDir, (unsigned long long)key);
+
+    return path;
+}
+
+/* creates path and any missing parents */
+static BFBool bfcMakeDirectory(const char *path)
+{
+    char *const partial = bfcCloneString(path);
+    BFBool made = BFC_TRUE;
+
+    for (char *c = partial + 1; made && *c != '\0'; c++)
+    {
+        if (*c != '/')
+        {
+            continue;
+        }
+
+        *c = '\0';
+        made = (BFC_MKDIR(partial) == 0 || errno == EEXIST) ? BFC_TRUE : BFC_FALSE;
+        *c = '/';
+    }
+
+    if (made)
+    {
+        made = (BFC_MKDIR(partial) == 0 || errno == EEXIST) ? BFC_TRUE : BFC_FALSE;
+    }
+
+    BFC_FREE(partial);
+    return made;
 }
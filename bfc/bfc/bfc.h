@@ -12,23 +12,222 @@ typedef enum BFInstr
     BFC_WRITE,
     BFC_READ,
     BFC_JZ,
-    BFC_JMP,
+    BFC_JNZ,
+    BFC_SET,
+    BFC_SCAN,
+    BFC_MUL,
     BFC_END
 } BFInstr;
 
-typedef union BFOperand
+typedef struct BFSourcePosition
 {
-    size_t instrLine;
-    u16    dataOffset;
-    u8     byteOffset;
-} BFOperand;
+    size_t line;
+    size_t column;
+} BFSourcePosition;
 
-typedef struct BFOpCode
+typedef enum BFOptLevel
 {
-    BFOperand operands;
-    BFInstr   instr;
-} BFOpCode;
+    BFC_OPT_NONE     = 0,
+    BFC_OPT_PEEPHOLE = 1,
+    BFC_OPT_DATAFLOW = 2
+} BFOptLevel;
 
-const BFOpCode *bfcCompile(const char *filepath);
+/*
+ * How long one stage of a compile took, in nanoseconds, and how big the
+ * program was after it: IR nodes up to the lowering, instructions from then
+ * on.
+ */
+typedef struct BFStageTiming
+{
+    const char *name;
+    u64         nanoseconds;
+    size_t      nodes;
+} BFStageTiming;
+
+#define BFC_MAX_STAGES 24
+
+/* the parser, every optimization pass that ran, the lowering and the prefix, in the order they ran */
+typedef struct BFCompileReport
+{
+    BFStageTiming stages[BFC_MAX_STAGES];
+    size_t        count;
+} BFCompileReport;
+
+/*
+ * cellBits is the width of a tape cell, 8, 16 or 32. Cell arithmetic is folded
+ * modulo 2^cellBits, so a program has to run with the width it was compiled
+ * for.
+ *
+ * With a cacheDir, compiled programs are kept there as bytecode images named
+ * after a hash of the source and the options, and a later compile of the same
+ * source with the same options maps the image instead. NULL or an empty
+ * string always compiles.
+ *
+ * sourceMap asks for the source position of every word in the program. Images
+ * do not carry positions, so it bypasses the cache.
+ *
+ * prefixSteps is how many instructions the compiler may run ahead of time to
+ * find the program's prefix, see BFProgram; 0 runs none. Only programs
+ * optimized at BFC_OPT_PEEPHOLE or above get a prefix.
+ *
+ * A report, if not NULL, receives the time every stage of the compile took.
+ * A cached program has no stages to report, so a report bypasses the cache.
+ */
+typedef struct BFCompileOptions
+{
+    BFOptLevel       level;
+    u8               cellBits;
+    const char      *cacheDir;
+    BFBool           sourceMap;
+    u64              prefixSteps;
+    BFCompileReport *report;
+} BFCompileOptions;
+
+#define BFC_DEFAULT_CELL_BITS    8
+#define BFC_DEFAULT_PREFIX_STEPS 1000000ULL
+
+#define BFC_BYTECODE_EXTENSION ".bfbc"
+#define BFC_C_EXTENSION        ".c"
+
+/*
+ * Compiled programs are a stream of 32-bit words. The low byte of a word holds
+ * the BFInstr and the upper 24 bits its operand, which is either one unsigned
+ * field (pointer moves, jump targets) or an 8-bit value followed by a signed
+ * 16-bit cell offset (ADDB, SUBB, SET, WRITE, READ, SCAN, MUL).
+ *
+ * The value of WRITE is how many times the cell is output in a row, at most
+ * BFC_MAX_REPEAT.
+ *
+ * A loop is a JZ that jumps past its JNZ while the current cell is zero and a
+ * JNZ that jumps back to the first instruction of the body while it is not,
+ * so an iteration costs a single test and dispatch for the loop edge.
+ *
+ * MUL is followed by a second word holding its signed target offset. A jump
+ * whose target does not fit in 24 bits stores BFC_WIDE_OPERAND and is followed
+ * by a word holding the full target.
+ *
+ * Cell values wider than 8 bits only occur with 16- and 32-bit cells. Such a
+ * cell op has BFC_WIDE_VALUE set in its low byte and carries the full value in
+ * one extra trailing word, after MUL's target word.
+ */
+typedef u32 BFOpCode;
+
+#define BFC_WIDE_OPERAND 0xFFFFFFUL
+#define BFC_MAX_OPERAND  0xFFFFFFUL
+#define BFC_MAX_REPEAT   0xFFUL
+
+#define BFC_WIDE_VALUE 0x80UL
+
+#define BFC_INSTR(OP)   ((BFInstr)((OP) & 0x7F))
+#define BFC_OPERAND(OP) ((u32)(OP) >> 8)
+#define BFC_VALUE(OP)   ((u8)((OP) >> 8))
+#define BFC_OFFSET(OP)  ((i16)(u16)((OP) >> 16))
+
+#define BFC_JUMP_WIDTH(OP)                                  \
+    ((BFC_OPERAND(OP) == BFC_WIDE_OPERAND) ? 2UL : 1UL)     \
+
+#define BFC_JUMP_TARGET(CODE, IP)                           \
+    ((BFC_OPERAND((CODE)[IP]) == BFC_WIDE_OPERAND)          \
+        ? (size_t)(CODE)[(IP) + 1]                          \
+        : (size_t)BFC_OPERAND((CODE)[IP]))                  \
+
+#define BFC_MUL_TARGET(CODE, IP) ((i32)(CODE)[(IP) + 1])
+
+#define BFC_CELL_VALUE(CODE, IP)                            \
+    (((CODE)[IP] & BFC_WIDE_VALUE)                          \
+        ? (u32)(CODE)[(IP) + 1]                             \
+        : (u32)BFC_VALUE((CODE)[IP]))                       \
+
+#define BFC_MUL_FACTOR(CODE, IP)                            \
+    (((CODE)[IP] & BFC_WIDE_VALUE)                          \
+        ? (u32)(CODE)[(IP) + 2]                             \
+        : (u32)BFC_VALUE((CODE)[IP]))                       \
+
+#define BFC_WIDTH(OP)                                       \
+    (((BFC_INSTR(OP) == BFC_MUL) ? 2UL                      \
+        : (BFC_INSTR(OP) == BFC_JZ || BFC_INSTR(OP) == BFC_JNZ) \
+            ? BFC_JUMP_WIDTH(OP)                            \
+            : 1UL) + (((OP) & BFC_WIDE_VALUE) ? 1UL : 0UL)) \
+
+typedef enum BFCompileStatus
+{
+    BFC_COMPILE_OK,
+    BFC_COMPILE_IO_ERROR,
+    BFC_COMPILE_SYNTAX_ERROR,
+    BFC_COMPILE_OUT_OF_MEMORY,
+    BFC_COMPILE_INVALID_OPTIONS,
+    BFC_COMPILE_INVALID_BYTECODE
+} BFCompileStatus;
+
+/*
+ * A compiled program. size counts the words before the terminating BFC_END.
+ * minOffset and maxOffset are the lowest and highest cells touched relative to
+ * the starting cell; they are exact only when the program is bounded, meaning
+ * it has no scans and the pointer ends every loop iteration where it began.
+ *
+ * reach bounds how far from the last cell it read the program can address
+ * before reading the current cell again, i.e. the pointer moves of one
+ * straight-line stretch plus the largest cell offset used in it. cellBits is
+ * the cell width the program was compiled for.
+ *
+ * A program loaded from a bytecode image runs straight from the mapped file;
+ * image is then that mapping and code points into it, otherwise image is NULL.
+ *
+ * positions holds size + 1 entries, the position in the source that each word
+ * came from, when the program was compiled with sourceMap and is NULL
+ * otherwise. Instructions fused by the optimizer map to the first token they
+ * replace; loops turned into SET, SCAN or MUL map to their '['.
+ *
+ * The prefix is where the program gets to before it depends on its input:
+ * started on a zeroed tape, it stops before the instruction at prefixIp with
+ * the data pointer at prefixDp, having taken prefixEdges loop back-edges,
+ * written the prefixOutputSize bytes at prefixOutput and reached the first
+ * prefixSpan cells of the tape. prefixTape holds the first prefixCells of
+ * them, cellBits wide each, and the rest are zero. A run may start from
+ * there instead of from the beginning, as long as its tape holds prefixSpan
+ * cells. prefixIp is 0 when the program has no prefix.
+ */
+typedef struct BFProgram
+{
+    BFOpCode         *code;
+    size_t            size;
+    size_t            instrCount;
+    size_t            loopCount;
+    i64               minOffset;
+    i64               maxOffset;
+    size_t            reach;
+    u8                cellBits;
+    BFBool            bounded;
+    void             *image;
+    size_t            imageSize;
+    BFSourcePosition *positions;
+    size_t            prefixIp;
+    size_t            prefixDp;
+    size_t            prefixSpan;
+    u64               prefixEdges;
+    u8               *prefixTape;
+    size_t            prefixCells;
+    u8               *prefixOutput;
+    size_t            prefixOutputSize;
+} BFProgram;
+
+BFProgram *bfcCompile(const char *filepath, const BFCompileOptions *options, BFCompileStatus *status);
+void bfcFreeProgram(BFProgram *program);
+
+/*
+ * Compiles size bytes of source held in memory. name stands in for the file
+ * name in diagnostics and may be NULL. The source is only read during the
+ * call.
+ */
+BFProgram *bfcCompileSource(const char *name, const char *source, size_t size, const BFCompileOptions *options, BFCompileStatus *status);
+
+BFProgram *bfcLoadProgram(const char *filepath, BFCompileStatus *status);
+BFBool bfcSaveProgram(const BFProgram *program, const char *filepath);
+
+/*
+ * Writes the program as a standalone C program to filepath. programName only
+ * appears in a comment at the top of the file.
+ */
+BFBool bfcEmitC(const BFProgram *program, const char *programName, const char *filepath);
 
 #endif /* BFC_H */
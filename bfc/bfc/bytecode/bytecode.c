@@ -0,0 +1,229 @@
+#include "bytecode.h"
+
+#include "core/memory.h"
+
+#define BFC_WORD(INSTR, OPERAND) ((BFOpCode)(INSTR) | ((BFOpCode)(OPERAND) << 8))
+#define BFC_CELL_WORD(INSTR, VALUE, OFFSET) BFC_WORD(INSTR, (u32)(VALUE) | ((u32)(u16)(OFFSET) << 8))
+
+/* cell values that do not fit the 8-bit field move to a trailing word */
+#define BFC_IS_WIDE(VALUE) ((VALUE) > 0xFF)
+
+static size_t bfcLayout(const BFInstruction *code, size_t count, size_t *offsets, BFBool wideJumps);
+static BFBool bfcHasValue(BFInstr instr);
+
+/*
+ * Lays the program out as packed words. Jump targets are word indices, so the
+ * layout is computed first; if the program grows past what a 24-bit operand
+ * can address, every jump takes the two-word escape form instead.
+ *
+ * If sources is not NULL it receives the source offset of every word, the
+ * trailing words of an instruction sharing the offset of its first.
+ */
+BFOpCode *bfcEncodeProgram(const BFInstruction *code, size_t **sources)
+{
+    size_t count = 0;
+    while (code[count].instr != BFC_END)
+    {
+        count++;
+    }
+
+    size_t *const offsets = BFC_TRY_MALLOC(size_t, count + 1);
+    if (!offsets)
+    {
+        return NULL;
+    }
+
+    BFBool wideJumps = BFC_FALSE;
+    size_t size = bfcLayout(code, count, offsets, wideJumps);
+    if (size >= BFC_WIDE_OPERAND)
+    {
+        wideJumps = BFC_TRUE;
+        size = bfcLayout(code, count, offsets, wideJumps);
+    }
+
+    BFOpCode *const words = BFC_TRY_MALLOC(BFOpCode, size + 1);
+    size_t *const map = sources ? BFC_TRY_MALLOC(size_t, size + 1) : NULL;
+    if (!words || (sources && !map))
+    {
+        BFC_FREE(words);
+        BFC_FREE(map);
+        BFC_FREE(offsets);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        BFOpCode *const word = &words[offsets[i]];
+        const BFOperand *const operands = &code[i].operands;
+
+        switch (code[i].instr)
+        {
+            case BFC_ADDB:
+            case BFC_SUBB:
+            case BFC_SET:
+            case BFC_WRITE:
+            case BFC_READ:
+                if (BFC_IS_WIDE(operands->cell.value))
+                {
+                    word[0] = BFC_CELL_WORD(code[i].instr, 0, operands->cell.offset) | BFC_WIDE_VALUE;
+                    word[1] = operands->cell.value;
+                }
+                else
+                {
+                    word[0] = BFC_CELL_WORD(code[i].instr, operands->cell.value, operands->cell.offset);
+                }
+                break;
+            case BFC_ADDP:
+            case BFC_SUBP:
+                word[0] = BFC_WORD(code[i].instr, operands->dataOffset);
+                break;
+            case BFC_SCAN:
+                word[0] = BFC_CELL_WORD(BFC_SCAN, 0, operands->scanStep);
+                break;
+            case BFC_MUL:
+                if (BFC_IS_WIDE(operands->mulAdd.factor))
+                {
+                    word[0] = BFC_CELL_WORD(BFC_MUL, 0, operands->mulAdd.offset) | BFC_WIDE_VALUE;
+                    word[2] = operands->mulAdd.factor;
+                }
+                else
+                {
+                    word[0] = BFC_CELL_WORD(BFC_MUL, operands->mulAdd.factor, operands->mulAdd.offset);
+                }
+                word[1] = (BFOpCode)(i32)operands->mulAdd.target;
+                break;
+            case BFC_JZ:
+            case BFC_JNZ:
+            {
+                /* a JNZ refers to its JZ but jumps to the start of the body after it */
+                const size_t target = offsets[operands->instrLine + ((code[i].instr == BFC_JNZ) ? 1 : 0)];
+                if (wideJumps)
+                {
+                    word[0] = BFC_WORD(code[i].instr, BFC_WIDE_OPERAND);
+                    word[1] = (BFOpCode)target;
+                }
+                else
+                {
+                    word[0] = BFC_WORD(code[i].instr, target);
+                }
+            } break;
+            default:
+                word[0] = BFC_WORD(code[i].instr, 0);
+                break;
+        }
+    }
+
+    words[size] = BFC_WORD(BFC_END, 0);
+
+    if (sources)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            for (size_t w = offsets[i]; w < offsets[i + 1]; w++)
+            {
+                map[w] = code[i].source;
+            }
+        }
+
+        map[size] = code[count].source;
+        *sources = map;
+    }
+
+    BFC_FREE(offsets);
+
+    return words;
+}
+
+/*
+ * Checks that code came out of bfcEncodeProgram for the given cell width:
+ * every word decodes to a known instruction that ends before the terminating
+ * BFC_END, wide values only appear where the width allows them, and every
+ * loop is a JZ that jumps past its JNZ and a JNZ that jumps back to the
+ * instruction after its JZ.
+ */
+BFBool bfcVerifyProgram(const BFOpCode *code, size_t size, u8 cellBits)
+{
+    if (cellBits != 8 && cellBits != 16 && cellBits != 32)
+    {
+        return BFC_FALSE;
+    }
+
+    size_t *const loops = BFC_TRY_MALLOC(size_t, size + 1);
+    if (!loops)
+    {
+        return BFC_FALSE;
+    }
+
+    size_t depth = 0;
+    size_t ip = 0;
+    BFBool valid = BFC_TRUE;
+    while (valid && ip < size)
+    {
+        const BFOpCode op = code[ip];
+        const BFInstr instr = BFC_INSTR(op);
+        const size_t width = BFC_WIDTH(op);
+
+        if (instr >= BFC_END || width > size - ip)
+        {
+            valid = BFC_FALSE;
+        }
+        else if ((op & BFC_WIDE_VALUE) && (cellBits == 8 || !bfcHasValue(instr)))
+        {
+            valid = BFC_FALSE;
+        }
+        else if (instr == BFC_JZ)
+        {
+            loops[depth++] = ip;
+        }
+        else if (instr == BFC_JNZ)
+        {
+            valid = depth > 0 &&
+                    BFC_JUMP_TARGET(code, ip) == loops[depth - 1] + BFC_WIDTH(code[loops[depth - 1]]) &&
+                    BFC_JUMP_TARGET(code, loops[depth - 1]) == ip + width;
+            depth -= valid ? 1 : 0;
+        }
+
+        ip += valid ? width : 0;
+    }
+
+    BFC_FREE(loops);
+    return (valid && depth == 0 && ip == size && BFC_INSTR(code[size]) == BFC_END) ? BFC_TRUE : BFC_FALSE;
+}
+
+static size_t bfcLayout(const BFInstruction *code, size_t count, size_t *offsets, BFBool wideJumps)
+{
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        offsets[i] = pos;
+        switch (code[i].instr)
+        {
+            case BFC_ADDB:
+            case BFC_SUBB:
+            case BFC_SET:
+            case BFC_WRITE:
+            case BFC_READ:
+                pos += BFC_IS_WIDE(code[i].operands.cell.value) ? 2 : 1;
+                break;
+            case BFC_MUL:
+                pos += BFC_IS_WIDE(code[i].operands.mulAdd.factor) ? 3 : 2;
+                break;
+            case BFC_JZ:
+            case BFC_JNZ:
+                pos += wideJumps ? 2 : 1;
+                break;
+            default:
+                pos++;
+                break;
+        }
+    }
+
+    offsets[count] = pos;
+    return pos;
+}
+
+/* instructions whose value may be too wide for the 8-bit field */
+static BFBool bfcHasValue(BFInstr instr)
+{
+    return (instr == BFC_ADDB || instr == BFC_SUBB || instr == BFC_SET || instr == BFC_MUL) ? BFC_TRUE : BFC_FALSE;
+}
@@ -0,0 +1,39 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "bfc.h"
+
+typedef union BFOperand
+{
+    size_t instrLine;
+    size_t dataOffset;
+    i16    scanStep;
+    struct
+    {
+        i16 offset;
+        u32 value;
+    } cell;
+    struct
+    {
+        i16 offset;
+        i16 target;
+        u32 factor;
+    } mulAdd;
+} BFOperand;
+
+/*
+ * source is the byte offset of the token an instruction came from. Passes
+ * that merge or rewrite instructions keep the offset of the first one, so
+ * every instruction can be traced back to a spot in the source.
+ */
+typedef struct BFInstruction
+{
+    BFOperand operands;
+    BFInstr   instr;
+    size_t    source;
+} BFInstruction;
+
+BFOpCode *bfcEncodeProgram(const BFInstruction *code, size_t **sources);
+BFBool bfcVerifyProgram(const BFOpCode *code, size_t size, u8 cellBits);
+
+#endif /* BYTECODE_H */
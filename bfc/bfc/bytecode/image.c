@@ -0,0 +1,179 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "image.h"
+
+#include "core/file.h"
+#include "core/hash.h"
+#include "core/memory.h"
+#include "core/platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(BFC_PLATFORM_WINDOWS)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+static BFBool bfcCheckHeader(const BFImageHeader *header, size_t imageSize);
+
+/* FNV-1a over the source, then over everything that changes the emitted code */
+u64 bfcImageKey(const u8 *source, size_t size, const BFCompileOptions *options)
+{
+    const u8 settings[] = {
+        (u8)options->level,
+        options->cellBits,
+        (u8)BFC_IMAGE_VERSION
+    };
+
+    const u64 hash = bfcHashBytes(BFC_HASH_SEED, source, size);
+    const u64 settingsHash = bfcHashBytes(hash, settings, sizeof(settings));
+    return bfcHashBytes(settingsHash, &options->prefixSteps, sizeof(options->prefixSteps));
+}
+
+/* replaced as bfcCommitReplacement describes, so a concurrent reader sees either no file or a complete one */
+BFBool bfcWriteImage(const BFProgram *program, u64 key, const char *filepath)
+{
+    BFImageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BFC_IMAGE_MAGIC;
+    header.version = BFC_IMAGE_VERSION;
+    header.byteOrder = BFC_IMAGE_BYTE_ORDER;
+    header.cellBits = program->cellBits;
+    header.key = key;
+    header.size = program->size;
+    header.prefixIp = program->prefixIp;
+    header.prefixDp = program->prefixDp;
+    header.prefixSpan = program->prefixSpan;
+    header.prefixEdges = program->prefixEdges;
+    header.prefixCells = program->prefixCells;
+    header.prefixOutput = program->prefixOutputSize;
+
+    char *const tempPath = bfcReplacementPath(filepath);
+    const int fd = bfcOpenReplacement(tempPath);
+    if (fd < 0)
+    {
+        BFC_FREE(tempPath);
+        return BFC_FALSE;
+    }
+
+    const size_t tapeBytes = program->prefixCells * (program->cellBits / 8);
+    const BFBool written = bfcWriteAll(fd, &header, sizeof(header)) &&
+                           bfcWriteAll(fd, program->code, sizeof(BFOpCode) * (program->size + 1)) &&
+                           bfcWriteAll(fd, program->prefixTape, tapeBytes) &&
+                           bfcWriteAll(fd, program->prefixOutput, program->prefixOutputSize);
+
+    const BFBool committed = bfcCommitReplacement(fd, tempPath, filepath, written);
+    BFC_FREE(tempPath);
+    return committed;
+}
+
+/*
+ * Maps an image and returns its code, or NULL if the file is missing or is
+ * not a complete image of this version. Only the framing is checked here; the
+ * code itself still has to be verified before it is run.
+ */
+BFOpCode *bfcMapImage(const char *filepath, BFImageHeader *header, void **image, size_t *imageSize)
+{
+    u8 *bytes = NULL;
+    size_t size = 0;
+
+#if defined(BFC_PLATFORM_WINDOWS)
+    FILE *file = NULL;
+    if (fopen_s(&file, filepath, "rb") != 0)
+    {
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        const long end = ftell(file);
+        if (end > 0 && fseek(file, 0, SEEK_SET) == 0)
+        {
+            size = (size_t)end;
+            bytes = BFC_TRY_MALLOC(u8, size);
+            if (bytes && fread(bytes, 1, size, file) != size)
+            {
+                BFC_FREE(bytes);
+                bytes = NULL;
+            }
+        }
+    }
+
+    fclose(file);
+#else
+    const int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        size = (size_t)info.st_size;
+        void *const view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        bytes = (view != MAP_FAILED) ? (u8 *)view : NULL;
+    }
+
+    close(fd);
+#endif
+
+    if (!bytes)
+    {
+        return NULL;
+    }
+
+    memcpy(header, bytes, (size < sizeof(*header)) ? size : sizeof(*header));
+    if (!bfcCheckHeader(header, size))
+    {
+        bfcUnmapImage(bytes, size);
+        return NULL;
+    }
+
+    *image = bytes;
+    *imageSize = size;
+    return (BFOpCode *)(bytes + sizeof(*header));
+}
+
+void bfcUnmapImage(void *image, size_t imageSize)
+{
+#if defined(BFC_PLATFORM_WINDOWS)
+    (void)imageSize;
+    BFC_FREE(image);
+#else
+    munmap(image, imageSize);
+#endif
+}
+
+static BFBool bfcCheckHeader(const BFImageHeader *header, size_t imageSize)
+{
+    if (imageSize < sizeof(*header) ||
+        header->magic != BFC_IMAGE_MAGIC ||
+        header->version != BFC_IMAGE_VERSION ||
+        header->byteOrder != BFC_IMAGE_BYTE_ORDER)
+    {
+        return BFC_FALSE;
+    }
+
+    /* every size is checked against what is left of the file before it is multiplied, so nothing overflows */
+    u64 left = imageSize - sizeof(*header);
+    if (header->size >= left / sizeof(BFOpCode))
+    {
+        return BFC_FALSE;
+    }
+
+    left -= (header->size + 1) * sizeof(BFOpCode);
+    const u64 cellSize = header->cellBits / 8;
+    if (cellSize == 0 || header->prefixCells > left / cellSize)
+    {
+        return BFC_FALSE;
+    }
+
+    left -= header->prefixCells * cellSize;
+    return (header->prefixOutput == left) ? BFC_TRUE : BFC_FALSE;
+}
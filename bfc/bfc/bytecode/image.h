@@ -0,0 +1,44 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "bfc.h"
+
+/*
+ * A bytecode image is a BFImageHeader followed by the program's words,
+ * terminating BFC_END included, then the prefixCells cells of the prefix tape
+ * and the prefixOutput bytes of its output, all in the byte order of the
+ * machine that wrote it. Images are mapped and run in place, so one written
+ * on a machine of the other byte order is rejected rather than converted.
+ *
+ * BFC_IMAGE_VERSION has to change whenever the encoding or the code the
+ * compiler emits for a given source changes, so that stale cache entries are
+ * never picked up.
+ */
+#define BFC_IMAGE_MAGIC      0x43424642UL /* "BFBC" */
+#define BFC_IMAGE_VERSION    4UL
+#define BFC_IMAGE_BYTE_ORDER 0x01020304UL
+
+typedef struct BFImageHeader
+{
+    u32 magic;
+    u32 version;
+    u32 byteOrder;
+    u8  cellBits;
+    u8  reserved[3];
+    u64 key;
+    u64 size;
+    u64 prefixIp;
+    u64 prefixDp;
+    u64 prefixSpan;
+    u64 prefixEdges;
+    u64 prefixCells;
+    u64 prefixOutput;
+} BFImageHeader;
+
+u64 bfcImageKey(const u8 *source, size_t size, const BFCompileOptions *options);
+
+BFBool bfcWriteImage(const BFProgram *program, u64 key, const char *filepath);
+BFOpCode *bfcMapImage(const char *filepath, BFImageHeader *header, void **image, size_t *imageSize);
+void bfcUnmapImage(void *image, size_t imageSize);
+
+#endif /* IMAGE_H */
@@ -0,0 +1,21 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "clock.h"
+#include "platform.h"
+
+#include <time.h>
+
+/* nanoseconds on a monotonic clock, or the wall clock on Windows */
+u64 bfcNow(void)
+{
+    struct timespec now;
+#if defined(BFC_PLATFORM_WINDOWS)
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+    return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
@@ -0,0 +1,8 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "types.h"
+
+u64 bfcNow(void);
+
+#endif /* CLOCK_H */
@@ -0,0 +1,92 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "file.h"
+#include "memory.h"
+#include "platform.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(BFC_PLATFORM_WINDOWS)
+#   include <fcntl.h>
+#   include <io.h>
+#   include <process.h>
+#   include <sys/stat.h>
+#   define BFC_FILE_OPEN(PATH)        _open(PATH, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE)
+#   define BFC_FILE_WRITE(FD, BUF, N) _write(FD, BUF, (unsigned int)(N))
+#   define BFC_FILE_SYNC(FD)          _commit(FD)
+#   define BFC_FILE_CLOSE(FD)         _close(FD)
+#   define BFC_GETPID()               _getpid()
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   define BFC_FILE_OPEN(PATH)        open(PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+#   define BFC_FILE_WRITE(FD, BUF, N) write(FD, BUF, N)
+#   define BFC_FILE_SYNC(FD)          fsync(FD)
+#   define BFC_FILE_CLOSE(FD)         close(FD)
+#   define BFC_GETPID()               getpid()
+#endif
+
+/* the process id keeps concurrent writers of the same file apart */
+char *bfcReplacementPath(const char *filepath)
+{
+    const size_t length = strlen(filepath) + 32;
+    char *const tempPath = BFC_MALLOC(char, length);
+    snprintf(tempPath, length, "%s.%ld.tmp", filepath, (long)BFC_GETPID());
+
+    return tempPath;
+}
+
+int bfcOpenReplacement(const char *tempPath)
+{
+    return BFC_FILE_OPEN(tempPath);
+}
+
+/* Windows cannot rename over an existing file, so there the old one goes first */
+BFBool bfcCommitReplacement(int fd, const char *tempPath, const char *filepath, BFBool written)
+{
+    written = written && BFC_FILE_SYNC(fd) == 0;
+    if (BFC_FILE_CLOSE(fd) != 0 || !written)
+    {
+        remove(tempPath);
+        return BFC_FALSE;
+    }
+
+#if defined(BFC_PLATFORM_WINDOWS)
+    remove(filepath);
+#endif
+
+    if (rename(tempPath, filepath) != 0)
+    {
+        remove(tempPath);
+        return BFC_FALSE;
+    }
+
+    return BFC_TRUE;
+}
+
+BFBool bfcWriteAll(int fd, const void *data, size_t size)
+{
+    const u8 *const bytes = (const u8 *)data;
+    size_t done = 0;
+    while (done < size)
+    {
+        const long written = (long)BFC_FILE_WRITE(fd, bytes + done, size - done);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            return BFC_FALSE;
+        }
+
+        done += (size_t)written;
+    }
+
+    return BFC_TRUE;
+}
@@ -0,0 +1,29 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include "types.h"
+
+/*
+ * A file is replaced by writing a temporary file next to it and renaming
+ * that into place, so a reader sees either the old file or the complete new
+ * one, never a part of it. The temporary file is synced before the rename,
+ * so a crash cannot leave a renamed file whose contents never made it to
+ * disk.
+ *
+ * bfcReplacementPath returns the temporary name for filepath, allocated with
+ * malloc, and bfcOpenReplacement creates the file under that name,
+ * returning its descriptor or -1. bfcCommitReplacement closes the file and
+ * renames it into place if written is true, removing it otherwise or if any
+ * step fails. bfcWriteAll writes all of size bytes, retrying short writes
+ * and interrupted calls.
+ *
+ * Only bfcReplacementPath allocates, so the others can be used in a forked
+ * copy of a threaded process.
+ */
+char *bfcReplacementPath(const char *filepath);
+int bfcOpenReplacement(const char *tempPath);
+BFBool bfcCommitReplacement(int fd, const char *tempPath, const char *filepath, BFBool written);
+
+BFBool bfcWriteAll(int fd, const void *data, size_t size);
+
+#endif /* FILE_H */
@@ -0,0 +1,14 @@
+#include "hash.h"
+
+#define BFC_HASH_PRIME 0x00000100000001B3ULL
+
+u64 bfcHashBytes(u64 hash, const void *data, size_t size)
+{
+    const u8 *const bytes = (const u8 *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * BFC_HASH_PRIME;
+    }
+
+    return hash;
+}
@@ -0,0 +1,11 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "types.h"
+
+/* 64-bit FNV-1a; a hash is started from BFC_HASH_SEED and carried on over more bytes */
+#define BFC_HASH_SEED 0xCBF29CE484222325ULL
+
+u64 bfcHashBytes(u64 hash, const void *data, size_t size);
+
+#endif /* HASH_H */
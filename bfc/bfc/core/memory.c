@@ -42,16 +42,21 @@ void bfcFree(void *ptr)
     free(ptr);
 }
 
+void *bfcTryMalloc(size_t numBytes)
+{
+    return malloc(numBytes);
+}
+
+void *bfcTryRealloc(void *ptr, size_t numBytes)
+{
+    return realloc(ptr, numBytes);
+}
+
 char *bfcCloneString(const char *s)
 {
     const size_t length = strlen(s) + 1;
     char *const clone = BFC_MALLOC(char, length);
-
-#if defined(BFC_PLATFORM_WINDOWS)
-    strcpy_s(clone, sizeof(char) * length, s);
-#elif defined(BFC_PLATFORM_LINUX)
-    strncpy(clone, s, length);
-#endif
+    memcpy(clone, s, length);
 
     return clone;
 }
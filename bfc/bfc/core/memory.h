@@ -8,11 +8,17 @@
 #define BFC_REALLOC(T, P, N) (T *)bfcRealloc(P, sizeof(T) * (N))
 #define BFC_FREE(P)          bfcFree(P)
 
+#define BFC_TRY_MALLOC(T, N)     (T *)bfcTryMalloc(sizeof(T) * (N))
+#define BFC_TRY_REALLOC(T, P, N) (T *)bfcTryRealloc(P, sizeof(T) * (N))
+
 void *bfcMalloc(size_t numBytes);
 void *bfcCalloc(size_t numElements, size_t bytesPerElement);
 void *bfcRealloc(void *ptr, size_t numBytes);
 void bfcFree(void *ptr);
 
+void *bfcTryMalloc(size_t numBytes);
+void *bfcTryRealloc(void *ptr, size_t numBytes);
+
 char *bfcCloneString(const char *s);
 
 #endif /* MEMORY_H */
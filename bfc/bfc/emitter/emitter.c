@@ -0,0 +1,335 @@
+#include "emitter.h"
+
+/* loops nested deeper than this are not indented further, which keeps the output linear in the program */
+#define BFC_C_MAX_INDENT 32UL
+
+/*
+ * The generated program keeps the VM's I/O behaviour: output is collected in
+ * a buffer that is flushed when full, after a newline on a terminal, before
+ * the program may block on input and at exit; input is read ahead in blocks.
+ * It does not check the data pointer, so it is meant for programs that are
+ * known to stay on the tape. BF_TAPE_SIZE and BF_EOF can be set when building
+ * the generated file.
+ */
+static const char *const s_Prelude =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "#if defined(__unix__) || defined(__APPLE__)\n"
+    "#   include <unistd.h>\n"
+    "#   define BF_READ(BUF, N) read(0, BUF, N)\n"
+    "#   define BF_ISATTY()    isatty(1)\n"
+    "#else\n"
+    "#   define BF_READ(BUF, N) fread(BUF, 1, N, stdin)\n"
+    "#   define BF_ISATTY()    0\n"
+    "#endif\n"
+    "\n"
+    "#if !defined(BF_TAPE_SIZE)\n"
+    "#   define BF_TAPE_SIZE %zu\n"
+    "#endif\n"
+    "\n"
+    "typedef %s cell;\n"
+    "\n"
+    "static cell s_Tape[BF_TAPE_SIZE];\n"
+    "\n"
+    "static unsigned char s_Output[65536];\n"
+    "static size_t s_OutputPos = 0;\n"
+    "static int s_LineBuffered = 0;\n"
+    "\n"
+    "static void bfFlush(void)\n"
+    "{\n"
+    "    fwrite(s_Output, 1, s_OutputPos, stdout);\n"
+    "    fflush(stdout);\n"
+    "    s_OutputPos = 0;\n"
+    "}\n"
+    "\n"
+    "static void bfPut(cell value, size_t count)\n"
+    "{\n"
+    "    while (count > 0)\n"
+    "    {\n"
+    "        if (s_OutputPos == sizeof(s_Output))\n"
+    "        {\n"
+    "            bfFlush();\n"
+    "        }\n"
+    "\n"
+    "        const size_t space = sizeof(s_Output) - s_OutputPos;\n"
+    "        const size_t chunk = (count < space) ? count : space;\n"
+    "        memset(s_Output + s_OutputPos, (unsigned char)value, chunk);\n"
+    "        s_OutputPos += chunk;\n"
+    "        count -= chunk;\n"
+    "    }\n"
+    "\n"
+    "    if (s_LineBuffered && (unsigned char)value == '\\n')\n"
+    "    {\n"
+    "        bfFlush();\n"
+    "    }\n"
+    "}\n";
+
+/* only emitted for programs that read, so the output builds without warnings */
+static const char *const s_Input =
+    "\n"
+    "static unsigned char s_Input[65536];\n"
+    "static size_t s_InputPos = 0;\n"
+    "static size_t s_InputEnd = 0;\n"
+    "\n"
+    "static void bfGet(cell *target)\n"
+    "{\n"
+    "    if (s_InputPos == s_InputEnd)\n"
+    "    {\n"
+    "        bfFlush();\n"
+    "\n"
+    "        const long count = (long)BF_READ(s_Input, sizeof(s_Input));\n"
+    "        if (count <= 0)\n"
+    "        {\n"
+    "#if defined(BF_EOF)\n"
+    "            *target = (cell)BF_EOF;\n"
+    "#endif\n"
+    "            return;\n"
+    "        }\n"
+    "\n"
+    "        s_InputPos = 0;\n"
+    "        s_InputEnd = (size_t)count;\n"
+    "    }\n"
+    "\n"
+    "    *target = s_Input[s_InputPos++];\n"
+    "}\n";
+
+static const char *const s_Main =
+    "\n"
+    "int main(void)\n"
+    "{\n"
+    "    cell *p = s_Tape;\n"
+    "    s_LineBuffered = BF_ISATTY();\n"
+    "\n";
+
+static const char *const s_Epilogue =
+    "\n"
+    "    bfFlush();\n"
+    "    return 0;\n"
+    "}\n";
+
+static const char *bfcCellType(u8 cellBits);
+static BFBool bfcReadsInput(const BFOpCode *code);
+static BFBool bfcPrefixOutsideLoops(const BFProgram *program);
+static void bfcWritePrefixData(const BFProgram *program, FILE *file);
+static void bfcIndent(FILE *file, size_t depth);
+
+/*
+ * Writes the program as a standalone C translation unit. Every instruction
+ * becomes one statement on the cell pointer p, and every loop a while loop,
+ * so the C compiler sees the program with all folding already done.
+ *
+ * A prefix that stops outside every loop replaces the code before it with
+ * its tape and output; one that stops inside a loop cannot be entered
+ * halfway in C, so the whole program is written then.
+ */
+BFBool bfcWriteC(const BFProgram *program, const char *programName, FILE *file)
+{
+    const BFOpCode *const code = program->code;
+    const BFBool prefixed = bfcPrefixOutsideLoops(program);
+    const u32 cellMask = (u32)(((u64)1 << program->cellBits) - 1);
+
+    size_t tapeSize = BFC_C_TAPE_SIZE;
+    if (program->bounded && program->maxOffset >= (i64)tapeSize)
+    {
+        tapeSize = (size_t)program->maxOffset + 1;
+    }
+
+    if (prefixed && program->prefixSpan > tapeSize)
+    {
+        tapeSize = program->prefixSpan;
+    }
+
+    fprintf(file, "/* Generated by bfc from %s */\n\n", programName);
+    fprintf(file, s_Prelude, tapeSize, bfcCellType(program->cellBits));
+    if (bfcReadsInput(code + (prefixed ? program->prefixIp : 0)))
+    {
+        fputs(s_Input, file);
+    }
+
+    if (prefixed)
+    {
+        bfcWritePrefixData(program, file);
+    }
+
+    fputs(s_Main, file);
+
+    size_t depth = 1;
+    size_t ip = 0;
+    if (prefixed)
+    {
+        if (program->prefixCells > 0)
+        {
+            fprintf(file, "    memcpy(s_Tape, s_PrefixTape, sizeof(s_PrefixTape));\n");
+        }
+
+        if (program->prefixOutputSize > 0)
+        {
+            fprintf(file, "    for (size_t i = 0; i < sizeof(s_PrefixOutput); i++)\n");
+            fprintf(file, "    {\n");
+            fprintf(file, "        bfPut(s_PrefixOutput[i], 1);\n");
+            fprintf(file, "    }\n");
+        }
+
+        fprintf(file, "    p += %zu;\n", program->prefixDp);
+        ip = program->prefixIp;
+    }
+    while (BFC_INSTR(code[ip]) != BFC_END)
+    {
+        const BFOpCode op = code[ip];
+        const long offset = (long)BFC_OFFSET(op);
+
+        if (BFC_INSTR(op) == BFC_JNZ)
+        {
+            depth--;
+        }
+
+        bfcIndent(file, depth);
+        switch (BFC_INSTR(op))
+        {
+            case BFC_ADDB:
+                fprintf(file, "p[%ld] += %lu;\n", offset, (unsigned long)BFC_CELL_VALUE(code, ip));
+                break;
+            case BFC_SUBB:
+                fprintf(file, "p[%ld] -= %lu;\n", offset, (unsigned long)BFC_CELL_VALUE(code, ip));
+                break;
+            case BFC_ADDP:
+                fprintf(file, "p += %lu;\n", (unsigned long)BFC_OPERAND(op));
+                break;
+            case BFC_SUBP:
+                fprintf(file, "p -= %lu;\n", (unsigned long)BFC_OPERAND(op));
+                break;
+            case BFC_WRITE:
+                fprintf(file, "bfPut(p[%ld], %lu);\n", offset, (unsigned long)BFC_VALUE(op));
+                break;
+            case BFC_READ:
+                fprintf(file, "bfGet(&p[%ld]);\n", offset);
+                break;
+            case BFC_JZ:
+                fprintf(file, "while (p[0])\n");
+                bfcIndent(file, depth);
+                fprintf(file, "{\n");
+                depth++;
+                break;
+            case BFC_JNZ:
+                fprintf(file, "}\n");
+                break;
+            case BFC_SET:
+                fprintf(file, "p[%ld] = %lu;\n", offset, (unsigned long)BFC_CELL_VALUE(code, ip));
+                break;
+            case BFC_SCAN:
+                fprintf(file, "while (p[0]) p += %ld;\n", offset);
+                break;
+            case BFC_MUL:
+            {
+                /* factors above half the cell range are negative ones, such as 255 for [->-<] */
+                const u32 factor = BFC_MUL_FACTOR(code, ip);
+                const BFBool negative = factor > cellMask / 2;
+                fprintf(file, "p[%ld] %s= (cell)((uint32_t)p[%ld] * %luU);\n", (long)BFC_MUL_TARGET(code, ip),
+                        negative ? "-" : "+", offset, (unsigned long)(negative ? (-factor & cellMask) : factor));
+            } break;
+            default:
+                break;
+        }
+
+        ip += BFC_WIDTH(op);
+    }
+
+    fputs(s_Epilogue, file);
+    return ferror(file) ? BFC_FALSE : BFC_TRUE;
+}
+
+static const char *bfcCellType(u8 cellBits)
+{
+    switch (cellBits)
+    {
+        case 16:
+            return "uint16_t";
+        case 32:
+            return "uint32_t";
+        default:
+            return "uint8_t";
+    }
+}
+
+static BFBool bfcReadsInput(const BFOpCode *code)
+{
+    for (size_t ip = 0; BFC_INSTR(code[ip]) != BFC_END; ip += BFC_WIDTH(code[ip]))
+    {
+        if (BFC_INSTR(code[ip]) == BFC_READ)
+        {
+            return BFC_TRUE;
+        }
+    }
+
+    return BFC_FALSE;
+}
+
+static BFBool bfcPrefixOutsideLoops(const BFProgram *program)
+{
+    if (program->prefixIp == 0)
+    {
+        return BFC_FALSE;
+    }
+
+    size_t depth = 0;
+    for (size_t ip = 0; ip < program->prefixIp; ip += BFC_WIDTH(program->code[ip]))
+    {
+        if (BFC_INSTR(program->code[ip]) == BFC_JZ)
+        {
+            depth++;
+        }
+        else if (BFC_INSTR(program->code[ip]) == BFC_JNZ)
+        {
+            depth--;
+        }
+    }
+
+    return (depth == 0) ? BFC_TRUE : BFC_FALSE;
+}
+
+/* the prefix tape and output as arrays, sixteen values to a line */
+static void bfcWritePrefixData(const BFProgram *program, FILE *file)
+{
+    if (program->prefixCells > 0)
+    {
+        fprintf(file, "\nstatic const cell s_PrefixTape[%zu] = {", program->prefixCells);
+        for (size_t i = 0; i < program->prefixCells; i++)
+        {
+            unsigned long value = program->prefixTape[i];
+            if (program->cellBits == 16)
+            {
+                value = ((const u16 *)program->prefixTape)[i];
+            }
+            else if (program->cellBits == 32)
+            {
+                value = ((const u32 *)program->prefixTape)[i];
+            }
+
+            fprintf(file, "%s%lu%s", (i % 16 == 0) ? "\n    " : " ", value, (i + 1 < program->prefixCells) ? "," : "\n");
+        }
+
+        fprintf(file, "};\n");
+    }
+
+    if (program->prefixOutputSize > 0)
+    {
+        fprintf(file, "\nstatic const unsigned char s_PrefixOutput[%zu] = {", program->prefixOutputSize);
+        for (size_t i = 0; i < program->prefixOutputSize; i++)
+        {
+            fprintf(file, "%s%u%s", (i % 16 == 0) ? "\n    " : " ", (unsigned)program->prefixOutput[i], (i + 1 < program->prefixOutputSize) ? "," : "\n");
+        }
+
+        fprintf(file, "};\n");
+    }
+}
+
+static void bfcIndent(FILE *file, size_t depth)
+{
+    const size_t levels = (depth < BFC_C_MAX_INDENT) ? depth : BFC_C_MAX_INDENT;
+    for (size_t i = 0; i < levels; i++)
+    {
+        fputs("    ", file);
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include "bfc.h"
+
+#include <stdio.h>
+
+#define BFC_C_TAPE_SIZE 30000UL
+
+BFBool bfcWriteC(const BFProgram *program, const char *programName, FILE *file);
+
+#endif /* EMITTER_H */
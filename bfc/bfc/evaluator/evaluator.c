@@ -0,0 +1,276 @@
+#include "evaluator.h"
+
+#include "core/memory.h"
+
+#include <string.h>
+
+#define INIT_OUTPUT_SIZE 256UL
+
+/* a run of the program at compile time; span is one past the highest cell it reached */
+typedef struct BFEvaluator
+{
+    const BFOpCode *code;
+    u32            *cells;
+    u32             cellMask;
+    size_t          span;
+    size_t          ip;
+    size_t          dp;
+    u64             edges;
+    u8             *output;
+    size_t          outputSize;
+    size_t          outputCapacity;
+} BFEvaluator;
+
+static BFBool bfcEvaluateStep(BFEvaluator *evaluator);
+static BFBool bfcEvaluateCell(BFEvaluator *evaluator, i64 offset, size_t *index);
+static BFBool bfcEvaluateOutput(BFEvaluator *evaluator, u8 byte, size_t count);
+static void bfcStorePrefix(BFProgram *program, BFEvaluator *evaluator);
+
+/*
+ * Runs the program the way the virtual machine does, on a zeroed tape and
+ * without input, and keeps the state it gets to as the program's prefix. The
+ * run stops at the end of the program, before the first READ, once steps
+ * instructions have run, or before an instruction that would leave the first
+ * BFC_PREFIX_MAX_CELLS cells or the output limit. Stopping is always safe, as
+ * a run started from the prefix executes that instruction itself.
+ */
+void bfcEvaluatePrefix(BFProgram *program, u64 steps)
+{
+    BFEvaluator evaluator;
+    evaluator.code = program->code;
+    evaluator.cells = BFC_CALLOC(u32, BFC_PREFIX_MAX_CELLS);
+    evaluator.cellMask = (u32)(((u64)1 << program->cellBits) - 1);
+    evaluator.span = 1;
+    evaluator.ip = 0;
+    evaluator.dp = 0;
+    evaluator.edges = 0;
+    evaluator.output = BFC_MALLOC(u8, INIT_OUTPUT_SIZE);
+    evaluator.outputSize = 0;
+    evaluator.outputCapacity = INIT_OUTPUT_SIZE;
+
+    while (steps > 0 && bfcEvaluateStep(&evaluator))
+    {
+        steps--;
+    }
+
+    bfcStorePrefix(program, &evaluator);
+
+    BFC_FREE(evaluator.output);
+    BFC_FREE(evaluator.cells);
+}
+
+/* checks a prefix read from an image before a virtual machine starts from it */
+BFBool bfcVerifyPrefix(const BFProgram *program)
+{
+    if (program->prefixIp == 0)
+    {
+        return (program->prefixDp == 0 && program->prefixSpan == 0 && program->prefixEdges == 0 &&
+                program->prefixCells == 0 && program->prefixOutputSize == 0) ? BFC_TRUE : BFC_FALSE;
+    }
+
+    if (program->prefixSpan > BFC_PREFIX_MAX_CELLS || program->prefixCells > program->prefixSpan ||
+        program->prefixDp >= program->prefixSpan || program->prefixOutputSize > BFC_PREFIX_MAX_OUTPUT)
+    {
+        return BFC_FALSE;
+    }
+
+    size_t ip = 0;
+    while (ip < program->prefixIp && ip < program->size)
+    {
+        ip += BFC_WIDTH(program->code[ip]);
+    }
+
+    return (ip == program->prefixIp) ? BFC_TRUE : BFC_FALSE;
+}
+
+/* runs the instruction at ip, or returns BFC_FALSE without running it if the prefix ends before it */
+static BFBool bfcEvaluateStep(BFEvaluator *evaluator)
+{
+    const BFOpCode *const code = evaluator->code;
+    const size_t ip = evaluator->ip;
+    const BFOpCode op = code[ip];
+    u32 *const cells = evaluator->cells;
+    size_t index = 0;
+
+    switch (BFC_INSTR(op))
+    {
+        case BFC_ADDB:
+            if (!bfcEvaluateCell(evaluator, BFC_OFFSET(op), &index))
+            {
+                return BFC_FALSE;
+            }
+
+            cells[index] = (cells[index] + BFC_CELL_VALUE(code, ip)) & evaluator->cellMask;
+            break;
+        case BFC_SUBB:
+            if (!bfcEvaluateCell(evaluator, BFC_OFFSET(op), &index))
+            {
+                return BFC_FALSE;
+            }
+
+            cells[index] = (cells[index] - BFC_CELL_VALUE(code, ip)) & evaluator->cellMask;
+            break;
+        case BFC_SET:
+            if (!bfcEvaluateCell(evaluator, BFC_OFFSET(op), &index))
+            {
+                return BFC_FALSE;
+            }
+
+            cells[index] = BFC_CELL_VALUE(code, ip) & evaluator->cellMask;
+            break;
+        case BFC_ADDP:
+            if (!bfcEvaluateCell(evaluator, BFC_OPERAND(op), &index))
+            {
+                return BFC_FALSE;
+            }
+
+            evaluator->dp = index;
+            break;
+        case BFC_SUBP:
+            if (!bfcEvaluateCell(evaluator, -(i64)BFC_OPERAND(op), &index))
+            {
+                return BFC_FALSE;
+            }
+
+            evaluator->dp = index;
+            break;
+        case BFC_WRITE:
+            if (!bfcEvaluateCell(evaluator, BFC_OFFSET(op), &index) || !bfcEvaluateOutput(evaluator, (u8)cells[index], BFC_VALUE(op)))
+            {
+                return BFC_FALSE;
+            }
+            break;
+        case BFC_JZ:
+            evaluator->ip = (cells[evaluator->dp] != 0) ? ip + BFC_JUMP_WIDTH(op) : BFC_JUMP_TARGET(code, ip);
+            return BFC_TRUE;
+        case BFC_JNZ:
+            if (cells[evaluator->dp] == 0)
+            {
+                evaluator->ip = ip + BFC_JUMP_WIDTH(op);
+                return BFC_TRUE;
+            }
+
+            evaluator->ip = BFC_JUMP_TARGET(code, ip);
+            evaluator->edges++;
+            return BFC_TRUE;
+        case BFC_SCAN:
+        {
+            /* the scan starts over from the same cell if the prefix ends inside it */
+            const size_t start = evaluator->dp;
+            while (cells[evaluator->dp] != 0)
+            {
+                if (!bfcEvaluateCell(evaluator, BFC_OFFSET(op), &index))
+                {
+                    evaluator->dp = start;
+                    return BFC_FALSE;
+                }
+
+                evaluator->dp = index;
+            }
+        } break;
+        case BFC_MUL:
+        {
+            size_t target = 0;
+            if (!bfcEvaluateCell(evaluator, BFC_OFFSET(op), &index) ||
+                (cells[index] != 0 && !bfcEvaluateCell(evaluator, BFC_MUL_TARGET(code, ip), &target)))
+            {
+                return BFC_FALSE;
+            }
+
+            if (cells[index] != 0)
+            {
+                cells[target] = (cells[target] + cells[index] * BFC_MUL_FACTOR(code, ip)) & evaluator->cellMask;
+            }
+        } break;
+        default:
+            /* READ waits for input, which the compiler does not have, and END has nothing left to run */
+            return BFC_FALSE;
+    }
+
+    evaluator->ip = ip + BFC_WIDTH(op);
+    return BFC_TRUE;
+}
+
+/* the cell offset cells away from the data pointer, if it is on the tape */
+static BFBool bfcEvaluateCell(BFEvaluator *evaluator, i64 offset, size_t *index)
+{
+    const i64 cell = (i64)evaluator->dp + offset;
+    if (cell < 0 || cell >= (i64)BFC_PREFIX_MAX_CELLS)
+    {
+        return BFC_FALSE;
+    }
+
+    *index = (size_t)cell;
+    if (*index >= evaluator->span)
+    {
+        evaluator->span = *index + 1;
+    }
+
+    return BFC_TRUE;
+}
+
+static BFBool bfcEvaluateOutput(BFEvaluator *evaluator, u8 byte, size_t count)
+{
+    if (count > BFC_PREFIX_MAX_OUTPUT - evaluator->outputSize)
+    {
+        return BFC_FALSE;
+    }
+
+    while (evaluator->outputSize + count > evaluator->outputCapacity)
+    {
+        evaluator->outputCapacity *= 2;
+        evaluator->output = BFC_REALLOC(u8, evaluator->output, evaluator->outputCapacity);
+    }
+
+    memset(evaluator->output + evaluator->outputSize, byte, count);
+    evaluator->outputSize += count;
+    return BFC_TRUE;
+}
+
+/* trailing zero cells are left out, a tape starts zeroed anyway */
+static void bfcStorePrefix(BFProgram *program, BFEvaluator *evaluator)
+{
+    if (evaluator->ip == 0)
+    {
+        return;
+    }
+
+    size_t cellCount = evaluator->span;
+    while (cellCount > 0 && evaluator->cells[cellCount - 1] == 0)
+    {
+        cellCount--;
+    }
+
+    const size_t cellSize = program->cellBits / 8;
+    u8 *const tape = (cellCount > 0) ? BFC_MALLOC(u8, cellCount * cellSize) : NULL;
+    for (size_t i = 0; i < cellCount; i++)
+    {
+        const u32 value = evaluator->cells[i];
+        switch (cellSize)
+        {
+            case 2:
+                ((u16 *)tape)[i] = (u16)value;
+                break;
+            case 4:
+                ((u32 *)tape)[i] = value;
+                break;
+            default:
+                tape[i] = (u8)value;
+                break;
+        }
+    }
+
+    program->prefixIp = evaluator->ip;
+    program->prefixDp = evaluator->dp;
+    program->prefixSpan = evaluator->span;
+    program->prefixEdges = evaluator->edges;
+    program->prefixTape = tape;
+    program->prefixCells = cellCount;
+
+    if (evaluator->outputSize > 0)
+    {
+        program->prefixOutput = BFC_REALLOC(u8, evaluator->output, evaluator->outputSize);
+        program->prefixOutputSize = evaluator->outputSize;
+        evaluator->output = NULL;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include "bfc.h"
+
+/*
+ * The prefix never reaches past BFC_PREFIX_MAX_CELLS cells or writes more than
+ * BFC_PREFIX_MAX_OUTPUT bytes, which bounds what a program and its image carry.
+ */
+#define BFC_PREFIX_MAX_CELLS  65536UL
+#define BFC_PREFIX_MAX_OUTPUT 1048576UL
+
+void bfcEvaluatePrefix(BFProgram *program, u64 steps);
+BFBool bfcVerifyPrefix(const BFProgram *program);
+
+#endif /* EVALUATOR_H */
@@ -0,0 +1,410 @@
+#include "ir.h"
+
+#include "core/memory.h"
+
+#define INIT_BLOCK_SIZE 8UL
+#define INIT_STACK_SIZE 32UL
+
+/* a block being walked, and the node to look at next */
+typedef struct BFBlockCursor
+{
+    const BFBlock *block;
+    size_t         next;
+    size_t         open;
+} BFBlockCursor;
+
+static size_t bfcLoweredSize(const BFNode *node);
+static size_t bfcLowerNode(const BFNode *node, u32 cellMask, BFInstruction *code, size_t pos);
+static BFBlockCursor *bfcPushCursor(BFBlockCursor *stack, size_t *stackSize, size_t depth, const BFBlock *block);
+
+/* returns NULL if out of memory */
+BFIrProgram *bfcCreateIr(u32 cellMask)
+{
+    BFIrProgram *const program = BFC_TRY_MALLOC(BFIrProgram, 1);
+    BFBlock *const body = program ? bfcCreateBlock() : NULL;
+    if (!body)
+    {
+        BFC_FREE(program);
+        return NULL;
+    }
+
+    program->body = body;
+    program->cellMask = cellMask;
+    program->endSource = 0;
+
+    return program;
+}
+
+void bfcFreeIr(BFIrProgram *program)
+{
+    if (!program)
+    {
+        return;
+    }
+
+    bfcFreeBlock(program->body);
+    BFC_FREE(program);
+}
+
+/* returns NULL if out of memory */
+BFBlock *bfcCreateBlock(void)
+{
+    BFBlock *const block = BFC_TRY_MALLOC(BFBlock, 1);
+    if (!block)
+    {
+        return NULL;
+    }
+
+    block->nodes = NULL;
+    block->count = 0;
+    block->capacity = 0;
+
+    return block;
+}
+
+/*
+ * Frees the block along with every loop in it, without recursing into them
+ * and without allocating, so it is safe on a tree left half built by running
+ * out of memory; a loop without a body is skipped. Nodes are dropped from the
+ * end of each block, and the last loop of the block being descended from
+ * holds the way back up in place of its body.
+ */
+void bfcFreeBlock(BFBlock *block)
+{
+    BFBlock *parent = NULL;
+    while (block)
+    {
+        while (block->count > 0 && (block->nodes[block->count - 1].kind != BFC_NODE_LOOP || !block->nodes[block->count - 1].as.loop.body))
+        {
+            block->count--;
+        }
+
+        if (block->count > 0)
+        {
+            BFNode *const loop = &block->nodes[block->count - 1];
+            BFBlock *const body = loop->as.loop.body;
+            loop->as.loop.body = parent;
+            parent = block;
+            block = body;
+            continue;
+        }
+
+        BFC_FREE(block->nodes);
+        BFC_FREE(block);
+
+        block = parent;
+        if (block)
+        {
+            BFNode *const loop = &block->nodes[block->count - 1];
+            parent = loop->as.loop.body;
+            loop->as.loop.body = NULL;
+        }
+    }
+}
+
+/* returns NULL if the block cannot grow, leaving it as it was */
+BFNode *bfcAppendNode(BFBlock *block, BFNodeKind kind, size_t source)
+{
+    if (block->count >= block->capacity)
+    {
+        const size_t capacity = (block->capacity > 0) ? block->capacity + (block->capacity / 2) : INIT_BLOCK_SIZE;
+        BFNode *const nodes = BFC_TRY_REALLOC(BFNode, block->nodes, capacity);
+        if (!nodes)
+        {
+            return NULL;
+        }
+
+        block->nodes = nodes;
+        block->capacity = capacity;
+    }
+
+    BFNode *const node = &block->nodes[block->count++];
+    node->kind = kind;
+    node->source = source;
+    node->as.loop.body = NULL;
+    node->as.loop.closeSource = 0;
+
+    return node;
+}
+
+/*
+ * Lists root and every block nested in it, inner blocks before the blocks
+ * holding them, so root comes last. The walk keeps its own stack, as nesting
+ * depth is only bounded by memory. Returns 0, with no list, if out of memory.
+ */
+size_t bfcCollectBlocks(BFBlock *root, BFBlock ***blocks)
+{
+    *blocks = NULL;
+
+    size_t stackSize = INIT_STACK_SIZE;
+    BFBlockCursor *stack = bfcPushCursor(BFC_TRY_MALLOC(BFBlockCursor, stackSize), &stackSize, 0, root);
+    size_t depth = 1;
+
+    size_t size = INIT_STACK_SIZE;
+    size_t count = 0;
+    BFBlock **list = stack ? BFC_TRY_MALLOC(BFBlock *, size) : NULL;
+    if (!list)
+    {
+        BFC_FREE(stack);
+        return 0;
+    }
+
+    while (depth > 0)
+    {
+        BFBlockCursor *const cursor = &stack[depth - 1];
+        const BFBlock *const block = cursor->block;
+        while (cursor->next < block->count && block->nodes[cursor->next].kind != BFC_NODE_LOOP)
+        {
+            cursor->next++;
+        }
+
+        if (cursor->next < block->count)
+        {
+            const BFBlock *const body = block->nodes[cursor->next++].as.loop.body;
+            stack = bfcPushCursor(stack, &stackSize, depth++, body);
+            if (!stack)
+            {
+                BFC_FREE(list);
+                return 0;
+            }
+            continue;
+        }
+
+        if (count >= size)
+        {
+            BFBlock **const grown = BFC_TRY_REALLOC(BFBlock *, list, size + (size / 2));
+            if (!grown)
+            {
+                BFC_FREE(stack);
+                BFC_FREE(list);
+                return 0;
+            }
+
+            list = grown;
+            size = size + (size / 2);
+        }
+
+        list[count++] = (BFBlock *)block;
+        depth--;
+    }
+
+    BFC_FREE(stack);
+    *blocks = list;
+    return count;
+}
+
+/* counts 0 if the blocks cannot be listed */
+size_t bfcCountNodes(const BFIrProgram *program)
+{
+    BFBlock **blocks = NULL;
+    const size_t count = bfcCollectBlocks(program->body, &blocks);
+
+    size_t nodes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        nodes += blocks[i]->count;
+    }
+
+    BFC_FREE(blocks);
+    return nodes;
+}
+
+/*
+ * Flattens the tree into instructions ending in BFC_END, ready for
+ * bfcEncodeProgram. Amounts too large for one instruction are split over
+ * several. Returns NULL if the instructions do not fit in memory.
+ */
+BFInstruction *bfcLowerProgram(const BFIrProgram *program)
+{
+    BFBlock **blocks = NULL;
+    const size_t blockCount = bfcCollectBlocks(program->body, &blocks);
+    if (blockCount == 0)
+    {
+        return NULL;
+    }
+
+    size_t total = 1;
+    for (size_t i = 0; i < blockCount; i++)
+    {
+        for (size_t j = 0; j < blocks[i]->count; j++)
+        {
+            total += bfcLoweredSize(&blocks[i]->nodes[j]);
+        }
+    }
+
+    BFC_FREE(blocks);
+
+    size_t stackSize = INIT_STACK_SIZE;
+    BFInstruction *const code = BFC_TRY_MALLOC(BFInstruction, total);
+    BFBlockCursor *stack = code ? bfcPushCursor(BFC_TRY_MALLOC(BFBlockCursor, stackSize), &stackSize, 0, program->body) : NULL;
+    if (!stack)
+    {
+        BFC_FREE(code);
+        return NULL;
+    }
+
+    size_t depth = 1;
+    size_t pos = 0;
+
+    while (depth > 0)
+    {
+        BFBlockCursor *const cursor = &stack[depth - 1];
+        if (cursor->next >= cursor->block->count)
+        {
+            /* the end of a loop body closes the loop around it */
+            if (--depth > 0)
+            {
+                const BFBlockCursor *const outer = &stack[depth - 1];
+                const BFNode *const loop = &outer->block->nodes[outer->next - 1];
+
+                code[cursor->open].operands.instrLine = pos + 1;
+                code[pos].instr = BFC_JNZ;
+                code[pos].source = loop->as.loop.closeSource;
+                code[pos++].operands.instrLine = cursor->open;
+            }
+            continue;
+        }
+
+        const BFNode *const node = &cursor->block->nodes[cursor->next++];
+        if (node->kind != BFC_NODE_LOOP)
+        {
+            pos = bfcLowerNode(node, program->cellMask, code, pos);
+            continue;
+        }
+
+        code[pos].instr = BFC_JZ;
+        code[pos].operands = (BFOperand){ 0 };
+        code[pos].source = node->source;
+
+        stack = bfcPushCursor(stack, &stackSize, depth++, node->as.loop.body);
+        if (!stack)
+        {
+            BFC_FREE(code);
+            return NULL;
+        }
+
+        stack[depth - 1].open = pos++;
+    }
+
+    code[pos].instr = BFC_END;
+    code[pos].operands = (BFOperand){ 0 };
+    code[pos].source = program->endSource;
+
+    BFC_FREE(stack);
+    return code;
+}
+
+/* how many instructions bfcLowerNode turns a node into, counting a loop as its JZ and JNZ */
+static size_t bfcLoweredSize(const BFNode *node)
+{
+    switch (node->kind)
+    {
+        case BFC_NODE_MOVE:
+        {
+            const u64 distance = (u64)((node->as.move > 0) ? node->as.move : -node->as.move);
+            return (size_t)((distance + BFC_MAX_OPERAND - 1) / BFC_MAX_OPERAND);
+        }
+        case BFC_NODE_WRITE:
+            return (node->as.cell.value + BFC_MAX_REPEAT - 1) / BFC_MAX_REPEAT;
+        case BFC_NODE_LOOP:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+static size_t bfcLowerNode(const BFNode *node, u32 cellMask, BFInstruction *code, size_t pos)
+{
+    BFInstruction *instr = &code[pos];
+    instr->operands = (BFOperand){ 0 };
+    instr->source = node->source;
+
+    switch (node->kind)
+    {
+        case BFC_NODE_ADD:
+        {
+            /* whichever of adding and subtracting takes the smaller value */
+            const u32 half = (cellMask >> 1) + 1;
+            const u32 value = node->as.cell.value;
+            instr->instr = (value <= half) ? BFC_ADDB : BFC_SUBB;
+            instr->operands.cell.offset = node->as.cell.offset;
+            instr->operands.cell.value = (value <= half) ? value : (-value & cellMask);
+        } return pos + 1;
+        case BFC_NODE_SET:
+        case BFC_NODE_READ:
+            instr->instr = (node->kind == BFC_NODE_SET) ? BFC_SET : BFC_READ;
+            instr->operands.cell.offset = node->as.cell.offset;
+            instr->operands.cell.value = node->as.cell.value;
+            return pos + 1;
+        case BFC_NODE_MUL:
+            instr->instr = BFC_MUL;
+            instr->operands.mulAdd.offset = node->as.mulAdd.offset;
+            instr->operands.mulAdd.target = node->as.mulAdd.target;
+            instr->operands.mulAdd.factor = node->as.mulAdd.factor;
+            return pos + 1;
+        case BFC_NODE_SCAN:
+            instr->instr = BFC_SCAN;
+            instr->operands.scanStep = node->as.step;
+            return pos + 1;
+        case BFC_NODE_MOVE:
+        {
+            const BFInstr move = (node->as.move > 0) ? BFC_ADDP : BFC_SUBP;
+            u64 remaining = (u64)((node->as.move > 0) ? node->as.move : -node->as.move);
+            while (remaining > 0)
+            {
+                const u64 step = (remaining > BFC_MAX_OPERAND) ? BFC_MAX_OPERAND : remaining;
+                instr = &code[pos++];
+                instr->instr = move;
+                instr->operands = (BFOperand){ 0 };
+                instr->source = node->source;
+                instr->operands.dataOffset = (size_t)step;
+                remaining -= step;
+            }
+        } return pos;
+        case BFC_NODE_WRITE:
+        {
+            u32 remaining = node->as.cell.value;
+            while (remaining > 0)
+            {
+                const u32 repeat = (remaining > BFC_MAX_REPEAT) ? (u32)BFC_MAX_REPEAT : remaining;
+                instr = &code[pos++];
+                instr->instr = BFC_WRITE;
+                instr->operands = (BFOperand){ 0 };
+                instr->source = node->source;
+                instr->operands.cell.offset = node->as.cell.offset;
+                instr->operands.cell.value = repeat;
+                remaining -= repeat;
+            }
+        } return pos;
+        default:
+            return pos;
+    }
+}
+
+/* frees the stack and returns NULL if it cannot grow, so the first push can be given a failed allocation */
+static BFBlockCursor *bfcPushCursor(BFBlockCursor *stack, size_t *stackSize, size_t depth, const BFBlock *block)
+{
+    if (!stack)
+    {
+        return NULL;
+    }
+
+    if (depth >= *stackSize)
+    {
+        BFBlockCursor *const grown = BFC_TRY_REALLOC(BFBlockCursor, stack, *stackSize + (*stackSize / 2));
+        if (!grown)
+        {
+            BFC_FREE(stack);
+            return NULL;
+        }
+
+        stack = grown;
+        *stackSize = *stackSize + (*stackSize / 2);
+    }
+
+    stack[depth].block = block;
+    stack[depth].next = 0;
+    stack[depth].open = 0;
+
+    return stack;
+}
@@ -0,0 +1,90 @@
+#ifndef IR_H
+#define IR_H
+
+#include "bytecode/bytecode.h"
+
+typedef struct BFBlock BFBlock;
+
+/*
+ * Offsets are relative to the data pointer and fit the 16-bit cell offsets of
+ * the encoding. Cell values are kept modulo the cell width: ADD holds the net
+ * amount added, so subtracting one is ADD with every bit of the cell set.
+ *
+ *   ADD    cell[offset] += value
+ *   MOVE   dp += move
+ *   SET    cell[offset] = value
+ *   MUL    cell[target] += cell[offset] * factor
+ *   SCAN   dp += step until cell[dp] is zero
+ *   READ   cell[offset] = next input byte
+ *   WRITE  output cell[offset] value times
+ *   LOOP   run body while cell[dp] is not zero
+ */
+typedef enum BFNodeKind
+{
+    BFC_NODE_ADD,
+    BFC_NODE_MOVE,
+    BFC_NODE_SET,
+    BFC_NODE_MUL,
+    BFC_NODE_SCAN,
+    BFC_NODE_READ,
+    BFC_NODE_WRITE,
+    BFC_NODE_LOOP
+} BFNodeKind;
+
+/* source is the byte offset of the token a node came from, closeSource that of a loop's ']' */
+typedef struct BFNode
+{
+    BFNodeKind kind;
+    size_t     source;
+    union
+    {
+        struct
+        {
+            i16 offset;
+            u32 value;
+        } cell;
+        i64 move;
+        i16 step;
+        struct
+        {
+            i16 offset;
+            i16 target;
+            u32 factor;
+        } mulAdd;
+        struct
+        {
+            BFBlock *body;
+            size_t   closeSource;
+        } loop;
+    } as;
+} BFNode;
+
+/* straight-line code, with every loop in it a LOOP node owning the block of its body */
+struct BFBlock
+{
+    BFNode *nodes;
+    size_t  count;
+    size_t  capacity;
+};
+
+/* a program as a tree of blocks; endSource is where the source ends */
+typedef struct BFIrProgram
+{
+    BFBlock *body;
+    u32      cellMask;
+    size_t   endSource;
+} BFIrProgram;
+
+BFIrProgram *bfcCreateIr(u32 cellMask);
+void bfcFreeIr(BFIrProgram *program);
+
+BFBlock *bfcCreateBlock(void);
+void bfcFreeBlock(BFBlock *block);
+BFNode *bfcAppendNode(BFBlock *block, BFNodeKind kind, size_t source);
+
+size_t bfcCollectBlocks(BFBlock *root, BFBlock ***blocks);
+size_t bfcCountNodes(const BFIrProgram *program);
+
+BFInstruction *bfcLowerProgram(const BFIrProgram *program);
+
+#endif /* IR_H */
@@ -1,3 +1,7 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
 #include "lexer.h"
 
 #include "core/error.h"
@@ -6,39 +10,110 @@
 #include <stdio.h>
 #include <string.h>
 
-#define IS_BF_CMD(ch)                            \
-    ((ch) == '+' || (ch) == '-' || (ch) == '>' ||\
-     (ch) == '<' || (ch) == '.' || (ch) == ',' ||\
-     (ch) == ']' || (ch) == '[')                 \
+#if !defined(BFC_PLATFORM_WINDOWS)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#define INIT_READ_SIZE 4096UL
 
+/*
+ * The whole source is mapped (or read) up front and scanned against a lookup
+ * table, so comment bytes cost one load and one compare each. Line and column
+ * numbers are only needed for diagnostics; they are derived lazily by counting
+ * newlines between the last queried position and the current token.
+ *
+ * A source handed in from memory is borrowed; the caller keeps it alive until
+ * the lexer is closed.
+ */
 struct BFLexer
 {
     BFSourcePosition position;
     char            *programName;
-    FILE            *source;
-    char             currentCharacter;
+    const u8        *source;
+    size_t           sourceSize;
+    size_t           cursor;
+    size_t           tokenPos;
+    size_t           countedPos;
+    size_t           lineStart;
+    BFBool           mapped;
+    BFBool           borrowed;
+};
+
+static const BFBool s_Commands[256] = {
+    ['+'] = BFC_TRUE, ['-'] = BFC_TRUE,
+    ['>'] = BFC_TRUE, ['<'] = BFC_TRUE,
+    ['.'] = BFC_TRUE, [','] = BFC_TRUE,
+    ['['] = BFC_TRUE, [']'] = BFC_TRUE
 };
 
-static void bfcNextCharacter(BFLexer *lexer);
+static u8 *bfcReadSource(FILE *file, size_t *size);
+static size_t bfcFindLine(const size_t *lineStarts, size_t lineCount, size_t offset);
 
 BFLexer *bfcInitLexer(const char *filepath)
 {
-#if defined(BFC_PLATFORM_LINUX)
-    FILE *const source = fopen(filepath, "r");
-    if (!source)
+    const u8 *source = NULL;
+    size_t sourceSize = 0;
+    BFBool mapped = BFC_FALSE;
+
+#if defined(BFC_PLATFORM_WINDOWS)
+    FILE *file = NULL;
+    if (fopen_s(&file, filepath, "rb") != 0)
     {
         bfcPrintError("could not open file: %s", filepath);
         return NULL;
     }
-#elif defined (BFC_PLATFORM_WINDOWS)
-    FILE *const source;
-    if (fopen_s(&source, filepath, "r") != 0)
+
+    source = bfcReadSource(file, &sourceSize);
+    fclose(file);
+#else
+    const int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
     {
         bfcPrintError("could not open file: %s", filepath);
         return NULL;
     }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void *const view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+            source = (const u8 *)view;
+            sourceSize = (size_t)info.st_size;
+            mapped = BFC_TRUE;
+        }
+    }
+
+    if (!mapped)
+    {
+        FILE *const file = fdopen(fd, "rb");
+        if (!file)
+        {
+            bfcPrintError("could not open file: %s", filepath);
+            close(fd);
+            return NULL;
+        }
+
+        source = bfcReadSource(file, &sourceSize);
+        fclose(file);
+    }
+    else
+    {
+        close(fd);
+    }
 #endif
 
+    if (!source)
+    {
+        bfcPrintError("could not read file: %s", filepath);
+        return NULL;
+    }
+
     const char *c = strchr(filepath, '/');
     if (!c)
     {
@@ -54,56 +129,217 @@ BFLexer *bfcInitLexer(const char *filepath)
     lexer->position.column = 0;
     lexer->programName = bfcCloneString(c);
     lexer->source = source;
-    lexer->currentCharacter = 0x00;
+    lexer->sourceSize = sourceSize;
+    lexer->cursor = 0;
+    lexer->tokenPos = 0;
+    lexer->countedPos = 0;
+    lexer->lineStart = 0;
+    lexer->mapped = mapped;
+    lexer->borrowed = BFC_FALSE;
+
+    return lexer;
+}
+
+BFLexer *bfcInitLexerFromMemory(const char *name, const u8 *source, size_t size)
+{
+    BFLexer *const lexer = BFC_MALLOC(BFLexer, 1);
+    lexer->position.line = 1;
+    lexer->position.column = 0;
+    lexer->programName = bfcCloneString(name ? name : "<source>");
+    lexer->source = (source && size > 0) ? source : (const u8 *)"";
+    lexer->sourceSize = (source && size > 0) ? size : 0;
+    lexer->cursor = 0;
+    lexer->tokenPos = 0;
+    lexer->countedPos = 0;
+    lexer->lineStart = 0;
+    lexer->mapped = BFC_FALSE;
+    lexer->borrowed = BFC_TRUE;
 
     return lexer;
 }
 
 void bfcCloseLexer(BFLexer *lexer)
 {
-    fclose(lexer->source);
+#if !defined(BFC_PLATFORM_WINDOWS)
+    if (lexer->mapped)
+    {
+        munmap((void *)lexer->source, lexer->sourceSize);
+    }
+    else
+#endif
+    if (!lexer->borrowed)
+    {
+        BFC_FREE((void *)lexer->source);
+    }
+
     BFC_FREE(lexer->programName);
     BFC_FREE(lexer);
 }
 
 BFToken bfcNextToken(BFLexer *lexer)
 {
-    do
+    const u8 *const source = lexer->source;
+    const size_t size = lexer->sourceSize;
+
+    size_t cursor = lexer->cursor;
+    while (cursor < size && !s_Commands[source[cursor]])
     {
-        bfcNextCharacter(lexer);
-    } while (!IS_BF_CMD(lexer->currentCharacter) && lexer->currentCharacter != EOF);
+        cursor++;
+    }
 
-    return (BFToken)lexer->currentCharacter;
+    lexer->tokenPos = cursor;
+    if (cursor >= size)
+    {
+        lexer->cursor = size;
+        return TOK_EOF;
+    }
+
+    lexer->cursor = cursor + 1;
+    return (BFToken)source[cursor];
 }
 
-BFSourcePosition bfcGetCurrentSourcePosition(const BFLexer *lexer)
+BFSourcePosition bfcGetCurrentSourcePosition(BFLexer *lexer)
 {
+    if (lexer->sourceSize == 0)
+    {
+        return lexer->position;
+    }
+
+    const size_t target = (lexer->tokenPos < lexer->sourceSize) ? lexer->tokenPos : lexer->sourceSize - 1;
+    if (target < lexer->countedPos)
+    {
+        return lexer->position;
+    }
+
+    const u8 *p = lexer->source + lexer->countedPos;
+    const u8 *const end = lexer->source + target;
+    const u8 *newline = NULL;
+    while ((newline = (const u8 *)memchr(p, '\n', (size_t)(end - p))) != NULL)
+    {
+        lexer->position.line++;
+        lexer->lineStart = (size_t)(newline - lexer->source) + 1;
+        p = newline + 1;
+    }
+
+    lexer->countedPos = target;
+    lexer->position.column = target - lexer->lineStart + 1;
+
     return lexer->position;
 }
 
+/* the byte offset of the current token, or the source size at the end */
+size_t bfcGetTokenOffset(const BFLexer *lexer)
+{
+    return lexer->tokenPos;
+}
+
+/*
+ * Turns byte offsets into line and column numbers. The offsets come in no
+ * particular order, so the line starts are collected once and each offset is
+ * looked up by binary search. Returns BFC_FALSE if that runs out of memory.
+ */
+BFBool bfcLocateSources(const BFLexer *lexer, const size_t *offsets, size_t count, BFSourcePosition *positions)
+{
+    size_t lineCount = 1;
+    for (const u8 *p = lexer->source, *end = p + lexer->sourceSize;
+         (p = (const u8 *)memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+    {
+        lineCount++;
+    }
+
+    size_t *const lineStarts = BFC_TRY_MALLOC(size_t, lineCount);
+    if (!lineStarts)
+    {
+        return BFC_FALSE;
+    }
+
+    lineStarts[0] = 0;
+    for (size_t i = 0, line = 1; i < lexer->sourceSize; i++)
+    {
+        if (lexer->source[i] == '\n')
+        {
+            lineStarts[line++] = i + 1;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t offset = offsets[i];
+        const size_t line = bfcFindLine(lineStarts, lineCount, offset);
+        positions[i].line = line + 1;
+        positions[i].column = offset - lineStarts[line] + 1;
+    }
+
+    BFC_FREE(lineStarts);
+    return BFC_TRUE;
+}
+
 const char *bfcGetProgramName(const BFLexer *lexer)
 {
     return lexer->programName;
 }
 
-static void bfcNextCharacter(BFLexer *lexer)
+const u8 *bfcGetSource(const BFLexer *lexer)
 {
-    static char last = 0x00;
+    return lexer->source;
+}
 
-    lexer->currentCharacter = (char)fgetc(lexer->source);
-    if (last == 0x0A && lexer->currentCharacter != EOF)
+size_t bfcGetSourceSize(const BFLexer *lexer)
+{
+    return lexer->sourceSize;
+}
+
+/* the index of the last line starting at or before offset */
+static size_t bfcFindLine(const size_t *lineStarts, size_t lineCount, size_t offset)
+{
+    size_t low = 0;
+    size_t high = lineCount;
+    while (high - low > 1)
     {
-        lexer->position.line++;
-        lexer->position.column = 1;
+        const size_t mid = low + (high - low) / 2;
+        if (lineStarts[mid] <= offset)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
     }
-    else if (lexer->currentCharacter == EOF)
+
+    return low;
+}
+
+static u8 *bfcReadSource(FILE *file, size_t *size)
+{
+    size_t capacity = INIT_READ_SIZE;
+    size_t length = 0;
+    u8 *buffer = BFC_TRY_MALLOC(u8, capacity);
+
+    while (buffer)
     {
-        return;
+        length += fread(buffer + length, 1, capacity - length, file);
+        if (length < capacity)
+        {
+            break;
+        }
+
+        capacity = capacity + (capacity / 2);
+        u8 *const grown = BFC_TRY_REALLOC(u8, buffer, capacity);
+        if (!grown)
+        {
+            BFC_FREE(buffer);
+        }
+
+        buffer = grown;
     }
-    else
+
+    if (buffer && ferror(file))
     {
-        lexer->position.column++;
+        BFC_FREE(buffer);
+        return NULL;
     }
 
-    last = lexer->currentCharacter;
+    *size = length;
+    return buffer;
 }
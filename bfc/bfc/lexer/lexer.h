@@ -1,16 +1,10 @@
 #ifndef LEXER_H
 #define LEXER_H
 
-#include "core/types.h"
+#include "bfc.h"
 
 typedef struct BFLexer BFLexer;
 
-typedef struct BFSourcePosition
-{
-    size_t line;
-    size_t column;
-} BFSourcePosition;
-
 typedef enum BFToken
 {
     TOK_EOF         = -1,   /* EOF */
@@ -25,11 +19,16 @@ typedef enum BFToken
 } BFToken;
 
 BFLexer *bfcInitLexer(const char *filepath);
+BFLexer *bfcInitLexerFromMemory(const char *name, const u8 *source, size_t size);
 void bfcCloseLexer(BFLexer *lexer);
 
 BFToken bfcNextToken(BFLexer *lexer);
 
-BFSourcePosition bfcGetCurrentSourcePosition(const BFLexer *lexer);
+BFSourcePosition bfcGetCurrentSourcePosition(BFLexer *lexer);
+size_t bfcGetTokenOffset(const BFLexer *lexer);
+BFBool bfcLocateSources(const BFLexer *lexer, const size_t *offsets, size_t count, BFSourcePosition *positions);
 const char *bfcGetProgramName(const BFLexer *lexer);
+const u8 *bfcGetSource(const BFLexer *lexer);
+size_t bfcGetSourceSize(const BFLexer *lexer);
 
 #endif /* LEXER_H */
@@ -0,0 +1,182 @@
+#include "dataflow.h"
+
+/* how far back bfcMergeStores looks for an earlier store to the same cell */
+#define BFC_STORE_WINDOW 32UL
+
+static BFBool bfcFindStore(const BFNode *nodes, size_t count, i16 offset, size_t *store);
+static BFBool bfcTouches(const BFNode *node, i16 offset);
+
+/*
+ * Drops code that does nothing because the current cell is known to be zero:
+ * a loop or scan entered on it never runs, multiplying from it adds nothing
+ * and clearing it again changes nothing. The current cell is zero at the
+ * start of the program, after every loop and scan, and once it is cleared.
+ * Runs before bfcFoldOffsets, while every pointer move is still a MOVE.
+ *
+ *   [-][->+<]        ->  SET 0
+ *   [comment]+       ->  ADD 1           at the start of the program
+ */
+BFBool bfcRemoveDeadCode(BFBlock *block, const BFPassContext *context)
+{
+    BFNode *const nodes = block->nodes;
+    BFBool zero = context->root;
+
+    size_t out = 0;
+    for (size_t in = 0; in < block->count; in++)
+    {
+        const BFNode node = nodes[in];
+        BFBool keep = BFC_TRUE;
+
+        switch (node.kind)
+        {
+            case BFC_NODE_LOOP:
+            case BFC_NODE_SCAN:
+                keep = !zero;
+                if (!keep && node.kind == BFC_NODE_LOOP)
+                {
+                    bfcFreeBlock(node.as.loop.body);
+                }
+
+                zero = BFC_TRUE;
+                break;
+            case BFC_NODE_SET:
+                if (node.as.cell.offset == 0)
+                {
+                    keep = !(zero && node.as.cell.value == 0);
+                    zero = (node.as.cell.value == 0) ? BFC_TRUE : BFC_FALSE;
+                }
+                break;
+            case BFC_NODE_MUL:
+                if (node.as.mulAdd.offset == 0 && zero)
+                {
+                    keep = BFC_FALSE;
+                }
+                else if (node.as.mulAdd.target == 0)
+                {
+                    zero = BFC_FALSE;
+                }
+                break;
+            case BFC_NODE_ADD:
+            case BFC_NODE_READ:
+                zero = (node.as.cell.offset == 0) ? BFC_FALSE : zero;
+                break;
+            case BFC_NODE_MOVE:
+                zero = BFC_FALSE;
+                break;
+            default:
+                break;
+        }
+
+        if (keep)
+        {
+            nodes[out++] = node;
+        }
+    }
+
+    block->count = out;
+
+    return BFC_TRUE;
+}
+
+/*
+ * Merges arithmetic on a cell into an earlier ADD or SET of the same cell
+ * when nothing in between reads or writes that cell, and turns multiplying
+ * from a cell just set into adding the product. Runs after bfcFoldOffsets,
+ * once the cell operations of a block share one data pointer.
+ *
+ *   SET [+0],0  ADD [+1],2  ADD [+0],1     ->  SET [+0],1  ADD [+1],2
+ *   ADD [+2],3  SET [+2],7                 ->  SET [+2],7
+ *   SET [+0],3  MUL [+0]->[+1],2           ->  SET [+0],3  ADD [+1],6
+ */
+BFBool bfcMergeStores(BFBlock *block, const BFPassContext *context)
+{
+    const u32 cellMask = context->cellMask;
+    BFNode *const nodes = block->nodes;
+
+    size_t out = 0;
+    for (size_t in = 0; in < block->count; in++)
+    {
+        BFNode node = nodes[in];
+        size_t store = 0;
+
+        if (node.kind == BFC_NODE_MUL && bfcFindStore(nodes, out, node.as.mulAdd.offset, &store) && nodes[store].kind == BFC_NODE_SET)
+        {
+            const u32 product = (nodes[store].as.cell.value * node.as.mulAdd.factor) & cellMask;
+            if (product == 0)
+            {
+                continue;
+            }
+
+            const i16 target = node.as.mulAdd.target;
+            node.kind = BFC_NODE_ADD;
+            node.as.cell.offset = target;
+            node.as.cell.value = product;
+        }
+
+        if ((node.kind != BFC_NODE_ADD && node.kind != BFC_NODE_SET) || !bfcFindStore(nodes, out, node.as.cell.offset, &store))
+        {
+            nodes[out++] = node;
+            continue;
+        }
+
+        BFNode *const earlier = &nodes[store];
+        if (node.kind == BFC_NODE_SET)
+        {
+            earlier->kind = BFC_NODE_SET;
+            earlier->as.cell.value = node.as.cell.value;
+        }
+        else
+        {
+            earlier->as.cell.value = (earlier->as.cell.value + node.as.cell.value) & cellMask;
+        }
+
+        /* an addition that cancels out goes away altogether */
+        if (earlier->kind == BFC_NODE_ADD && earlier->as.cell.value == 0)
+        {
+            for (size_t i = store + 1; i < out; i++)
+            {
+                nodes[i - 1] = nodes[i];
+            }
+
+            out--;
+        }
+    }
+
+    block->count = out;
+
+    return BFC_TRUE;
+}
+
+/* finds the last ADD or SET of offset among the first count nodes, unless something after it uses the cell */
+static BFBool bfcFindStore(const BFNode *nodes, size_t count, i16 offset, size_t *store)
+{
+    const size_t first = (count > BFC_STORE_WINDOW) ? count - BFC_STORE_WINDOW : 0;
+    for (size_t i = count; i > first; i--)
+    {
+        const BFNode *const node = &nodes[i - 1];
+        if (node->kind == BFC_NODE_MOVE || node->kind == BFC_NODE_SCAN || node->kind == BFC_NODE_LOOP)
+        {
+            return BFC_FALSE;
+        }
+
+        if (!bfcTouches(node, offset))
+        {
+            continue;
+        }
+
+        *store = i - 1;
+        return (node->kind == BFC_NODE_ADD || node->kind == BFC_NODE_SET) ? BFC_TRUE : BFC_FALSE;
+    }
+
+    return BFC_FALSE;
+}
+
+static BFBool bfcTouches(const BFNode *node, i16 offset)
+{
+    if (node->kind == BFC_NODE_MUL)
+    {
+        return (node->as.mulAdd.offset == offset || node->as.mulAdd.target == offset) ? BFC_TRUE : BFC_FALSE;
+    }
+
+    return (node->as.cell.offset == offset) ? BFC_TRUE : BFC_FALSE;
+}
@@ -0,0 +1,9 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include "passes.h"
+
+BFBool bfcRemoveDeadCode(BFBlock *block, const BFPassContext *context);
+BFBool bfcMergeStores(BFBlock *block, const BFPassContext *context);
+
+#endif /* DATAFLOW_H */
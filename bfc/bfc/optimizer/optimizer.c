@@ -0,0 +1,365 @@
+#include "optimizer.h"
+
+#include "core/memory.h"
+
+typedef struct BFCellDelta
+{
+    i64 offset;
+    u32 delta;
+} BFCellDelta;
+
+static size_t bfcRewriteLoop(const BFNode *loop, BFNode *out, BFCellDelta *deltas, u32 cellMask);
+static size_t bfcRewriteSimpleLoop(const BFNode *body, BFNode *out);
+static size_t bfcRewriteMulLoop(const BFBlock *body, BFNode *out, BFCellDelta *deltas, u32 cellMask);
+static void bfcFlushOffset(BFNode *nodes, size_t *out, i32 *offset, size_t source);
+static BFBool bfcFitsOffset(i64 offset);
+
+/*
+ * Merges adjacent arithmetic into one net operation each, modulo the cell
+ * width for cells, drops operations that cancel out and joins repeated
+ * output of the same cell. Runs at every optimization level; nodes only ever
+ * merge, so the rewrite happens in place.
+ *
+ *   +++--      ->  ADD 1
+ *   >><        ->  MOVE 1
+ *   +-><       ->  (nothing)
+ *   .+-.       ->  WRITE x2
+ */
+BFBool bfcFoldArithmetic(BFBlock *block, const BFPassContext *context)
+{
+    BFNode *const nodes = block->nodes;
+
+    size_t out = 0;
+    for (size_t in = 0; in < block->count; in++)
+    {
+        const BFNode *const node = &nodes[in];
+        BFNode *const last = (out > 0) ? &nodes[out - 1] : NULL;
+
+        switch (node->kind)
+        {
+            case BFC_NODE_ADD:
+                if (last && last->kind == BFC_NODE_ADD && last->as.cell.offset == node->as.cell.offset)
+                {
+                    last->as.cell.value = (last->as.cell.value + node->as.cell.value) & context->cellMask;
+                    out -= (last->as.cell.value == 0) ? 1 : 0;
+                    continue;
+                }
+
+                if ((node->as.cell.value & context->cellMask) == 0)
+                {
+                    continue;
+                }
+                break;
+            case BFC_NODE_MOVE:
+                if (last && last->kind == BFC_NODE_MOVE)
+                {
+                    last->as.move += node->as.move;
+                    out -= (last->as.move == 0) ? 1 : 0;
+                    continue;
+                }
+
+                if (node->as.move == 0)
+                {
+                    continue;
+                }
+                break;
+            case BFC_NODE_WRITE:
+                if (last && last->kind == BFC_NODE_WRITE && last->as.cell.offset == node->as.cell.offset &&
+                    last->as.cell.value <= UINT32_MAX - node->as.cell.value)
+                {
+                    last->as.cell.value += node->as.cell.value;
+                    continue;
+                }
+                break;
+            default:
+                break;
+        }
+
+        nodes[out++] = *node;
+    }
+
+    block->count = out;
+
+    return BFC_TRUE;
+}
+
+/*
+ * Replaces loops whose body is nothing but arithmetic with the effect of the
+ * whole loop. The replacement stands for the loop, so it maps to the '['.
+ *
+ *   [-] / [+]          ->  SET 0
+ *   [>>] / [<]         ->  SCAN +2 / SCAN -1
+ *   [->+>++<<]         ->  MUL +1,1  MUL +2,2  SET 0
+ */
+BFBool bfcRewriteIdioms(BFBlock *block, const BFPassContext *context)
+{
+    /* a loop is replaced by at most one node per node of its body, plus a SET */
+    size_t size = 0;
+    size_t loops = 0;
+    size_t longest = 0;
+    for (size_t i = 0; i < block->count; i++)
+    {
+        const BFNode *const node = &block->nodes[i];
+        const size_t body = (node->kind == BFC_NODE_LOOP) ? node->as.loop.body->count : 0;
+        size += body + 1;
+        loops += (node->kind == BFC_NODE_LOOP) ? 1 : 0;
+        longest = (body > longest) ? body : longest;
+    }
+
+    if (loops == 0)
+    {
+        return BFC_TRUE;
+    }
+
+    /* both are taken before anything changes, so running out of memory leaves the block whole */
+    BFNode *const nodes = BFC_TRY_MALLOC(BFNode, size);
+    BFCellDelta *const deltas = nodes ? BFC_TRY_MALLOC(BFCellDelta, longest + 1) : NULL;
+    if (!deltas)
+    {
+        BFC_FREE(nodes);
+        return BFC_FALSE;
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < block->count; i++)
+    {
+        const BFNode *const node = &block->nodes[i];
+        const size_t written = (node->kind == BFC_NODE_LOOP) ? bfcRewriteLoop(node, &nodes[out], deltas, context->cellMask) : 0;
+        if (written == 0)
+        {
+            nodes[out++] = *node;
+            continue;
+        }
+
+        for (size_t j = out; j < out + written; j++)
+        {
+            nodes[j].source = node->source;
+        }
+
+        bfcFreeBlock(node->as.loop.body);
+        out += written;
+    }
+
+    BFC_FREE(deltas);
+    BFC_FREE(block->nodes);
+    block->nodes = nodes;
+    block->count = out;
+    block->capacity = size;
+
+    return BFC_TRUE;
+}
+
+/*
+ * Folds pointer moves into the offsets of the cell operations after them.
+ * Moves are tracked as a virtual offset and applied as one MOVE wherever the
+ * real data pointer is observed: before loops, scans and the end of the
+ * block. Each emitted move replaces at least one original move, so the
+ * rewrite happens in place.
+ *
+ *   >>+<<-     ->  ADD [+2],1  ADD [+0],-1
+ *   >>[-]      ->  MOVE 2  SET 0
+ */
+BFBool bfcFoldOffsets(BFBlock *block, const BFPassContext *context)
+{
+    (void)context;
+
+    BFNode *const nodes = block->nodes;
+    size_t out = 0;
+    i32 offset = 0;
+    size_t moveSource = 0;
+
+    for (size_t in = 0; in < block->count; in++)
+    {
+        BFNode node = nodes[in];
+        switch (node.kind)
+        {
+            case BFC_NODE_MOVE:
+                if (!bfcFitsOffset(offset + node.as.move))
+                {
+                    bfcFlushOffset(nodes, &out, &offset, moveSource);
+                }
+
+                /* a move too large to ever become a cell offset is kept as a real move */
+                if (!bfcFitsOffset(node.as.move))
+                {
+                    nodes[out++] = node;
+                    continue;
+                }
+
+                /* a pending move is attributed to the first move folded into it */
+                if (offset == 0)
+                {
+                    moveSource = node.source;
+                }
+
+                offset += (i32)node.as.move;
+                continue;
+            case BFC_NODE_ADD:
+            case BFC_NODE_SET:
+            case BFC_NODE_READ:
+            case BFC_NODE_WRITE:
+                if (!bfcFitsOffset((i64)node.as.cell.offset + offset))
+                {
+                    bfcFlushOffset(nodes, &out, &offset, moveSource);
+                }
+
+                node.as.cell.offset = (i16)(node.as.cell.offset + offset);
+                nodes[out++] = node;
+                continue;
+            case BFC_NODE_MUL:
+                if (!bfcFitsOffset((i64)node.as.mulAdd.offset + offset) || !bfcFitsOffset((i64)node.as.mulAdd.target + offset))
+                {
+                    bfcFlushOffset(nodes, &out, &offset, moveSource);
+                }
+
+                node.as.mulAdd.offset = (i16)(node.as.mulAdd.offset + offset);
+                node.as.mulAdd.target = (i16)(node.as.mulAdd.target + offset);
+                nodes[out++] = node;
+                continue;
+            default:
+                break;
+        }
+
+        bfcFlushOffset(nodes, &out, &offset, moveSource);
+        nodes[out++] = node;
+    }
+
+    bfcFlushOffset(nodes, &out, &offset, moveSource);
+    block->count = out;
+
+    return BFC_TRUE;
+}
+
+/* returns how many nodes replace the loop, 0 if it stays a loop; deltas has room for one per node of the body */
+static size_t bfcRewriteLoop(const BFNode *loop, BFNode *out, BFCellDelta *deltas, u32 cellMask)
+{
+    const BFBlock *const body = loop->as.loop.body;
+    for (size_t i = 0; i < body->count; i++)
+    {
+        if (body->nodes[i].kind != BFC_NODE_ADD && body->nodes[i].kind != BFC_NODE_MOVE)
+        {
+            return 0;
+        }
+    }
+
+    const size_t written = (body->count == 1) ? bfcRewriteSimpleLoop(&body->nodes[0], out) : 0;
+    return (written > 0) ? written : bfcRewriteMulLoop(body, out, deltas, cellMask);
+}
+
+static size_t bfcRewriteSimpleLoop(const BFNode *body, BFNode *out)
+{
+    switch (body->kind)
+    {
+        case BFC_NODE_ADD:
+            /* an odd step is invertible modulo any power of two, so the cell always reaches zero */
+            if ((body->as.cell.value & 1) == 0 || body->as.cell.offset != 0)
+            {
+                return 0;
+            }
+
+            *out = (BFNode){ 0 };
+            out->kind = BFC_NODE_SET;
+            return 1;
+        case BFC_NODE_MOVE:
+            if (!bfcFitsOffset(body->as.move))
+            {
+                return 0;
+            }
+
+            *out = (BFNode){ 0 };
+            out->kind = BFC_NODE_SCAN;
+            out->as.step = (i16)body->as.move;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static size_t bfcRewriteMulLoop(const BFBlock *body, BFNode *out, BFCellDelta *deltas, u32 cellMask)
+{
+    size_t count = 0;
+    i64 offset = 0;
+
+    for (size_t i = 0; i < body->count; i++)
+    {
+        const BFNode *const node = &body->nodes[i];
+        if (node->kind == BFC_NODE_MOVE)
+        {
+            offset += node->as.move;
+            continue;
+        }
+
+        const i64 cell = offset + node->as.cell.offset;
+        size_t slot = 0;
+        while (slot < count && deltas[slot].offset != cell)
+        {
+            slot++;
+        }
+
+        if (slot == count)
+        {
+            deltas[count].offset = cell;
+            deltas[count++].delta = 0;
+        }
+
+        deltas[slot].delta = (deltas[slot].delta + node->as.cell.value) & cellMask;
+    }
+
+    u32 counter = 0;
+    BFBool valid = offset == 0;
+    for (size_t i = 0; i < count && valid; i++)
+    {
+        if (deltas[i].offset == 0)
+        {
+            counter = deltas[i].delta;
+        }
+        else if (!bfcFitsOffset(deltas[i].offset))
+        {
+            valid = BFC_FALSE;
+        }
+    }
+
+    /* the loop runs exactly cell times if the counter steps by -1, or 2^bits - cell times for +1 */
+    if (!valid || (counter != cellMask && counter != 0x01))
+    {
+        return 0;
+    }
+
+    size_t written = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (deltas[i].offset == 0 || deltas[i].delta == 0)
+        {
+            continue;
+        }
+
+        out[written] = (BFNode){ 0 };
+        out[written].kind = BFC_NODE_MUL;
+        out[written].as.mulAdd.target = (i16)deltas[i].offset;
+        out[written++].as.mulAdd.factor = (counter == cellMask) ? deltas[i].delta : (-deltas[i].delta & cellMask);
+    }
+
+    out[written] = (BFNode){ 0 };
+    out[written++].kind = BFC_NODE_SET;
+
+    return written;
+}
+
+static void bfcFlushOffset(BFNode *nodes, size_t *out, i32 *offset, size_t source)
+{
+    if (*offset == 0)
+    {
+        return;
+    }
+
+    nodes[*out] = (BFNode){ 0 };
+    nodes[*out].kind = BFC_NODE_MOVE;
+    nodes[*out].source = source;
+    nodes[(*out)++].as.move = *offset;
+    *offset = 0;
+}
+
+static BFBool bfcFitsOffset(i64 offset)
+{
+    return (offset >= INT16_MIN && offset <= INT16_MAX) ? BFC_TRUE : BFC_FALSE;
+}
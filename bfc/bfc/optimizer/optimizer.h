@@ -0,0 +1,10 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "passes.h"
+
+BFBool bfcFoldArithmetic(BFBlock *block, const BFPassContext *context);
+BFBool bfcRewriteIdioms(BFBlock *block, const BFPassContext *context);
+BFBool bfcFoldOffsets(BFBlock *block, const BFPassContext *context);
+
+#endif /* OPTIMIZER_H */
@@ -0,0 +1,94 @@
+#include "passes.h"
+#include "dataflow.h"
+#include "optimizer.h"
+
+#include "core/clock.h"
+#include "core/memory.h"
+
+/*
+ * Registers the standard pipeline. Arithmetic is folded at every level, so
+ * the output of -O0 is still free of runs that cancel out; the passes of
+ * -O2 need loop idioms rewritten before them and offsets folded in between.
+ * Returns BFC_FALSE if the pipeline does not fit in the manager.
+ */
+BFBool bfcInitPassManager(BFPassManager *manager)
+{
+    manager->count = 0;
+
+    return bfcAddPass(manager, "fold", BFC_OPT_NONE, bfcFoldArithmetic) &&
+           bfcAddPass(manager, "idioms", BFC_OPT_PEEPHOLE, bfcRewriteIdioms) &&
+           bfcAddPass(manager, "dead-code", BFC_OPT_DATAFLOW, bfcRemoveDeadCode) &&
+           bfcAddPass(manager, "offsets", BFC_OPT_PEEPHOLE, bfcFoldOffsets) &&
+           bfcAddPass(manager, "stores", BFC_OPT_DATAFLOW, bfcMergeStores);
+}
+
+/* returns BFC_FALSE if the manager already holds BFC_MAX_PASSES passes */
+BFBool bfcAddPass(BFPassManager *manager, const char *name, BFOptLevel level, BFPassFn run)
+{
+    if (manager->count >= BFC_MAX_PASSES)
+    {
+        return BFC_FALSE;
+    }
+
+    manager->passes[manager->count].name = name;
+    manager->passes[manager->count].level = level;
+    manager->passes[manager->count++].run = run;
+
+    return BFC_TRUE;
+}
+
+/*
+ * Runs every pass up to level over every block of the program, one pass at a
+ * time. The blocks are listed again for each pass, as a pass may drop loops.
+ * Returns BFC_FALSE if out of memory; the program is still whole, but may be
+ * left between passes.
+ */
+BFBool bfcRunPasses(const BFPassManager *manager, BFIrProgram *program, BFOptLevel level, BFCompileReport *report)
+{
+    for (size_t i = 0; i < manager->count; i++)
+    {
+        const BFPass *const pass = &manager->passes[i];
+        if (pass->level > level)
+        {
+            continue;
+        }
+
+        const u64 start = bfcNow();
+
+        BFBlock **blocks = NULL;
+        const size_t count = bfcCollectBlocks(program->body, &blocks);
+        BFBool ran = (count > 0) ? BFC_TRUE : BFC_FALSE;
+        for (size_t b = 0; b < count && ran; b++)
+        {
+            const BFPassContext context = { program->cellMask, (blocks[b] == program->body) ? BFC_TRUE : BFC_FALSE };
+            ran = pass->run(blocks[b], &context);
+        }
+
+        BFC_FREE(blocks);
+        if (!ran)
+        {
+            return BFC_FALSE;
+        }
+
+        if (report)
+        {
+            const u64 elapsed = bfcNow() - start;
+            bfcReportStage(report, pass->name, elapsed, bfcCountNodes(program));
+        }
+    }
+
+    return BFC_TRUE;
+}
+
+/* stages past BFC_MAX_STAGES are left out */
+void bfcReportStage(BFCompileReport *report, const char *name, u64 nanoseconds, size_t nodes)
+{
+    if (!report || report->count >= BFC_MAX_STAGES)
+    {
+        return;
+    }
+
+    report->stages[report->count].name = name;
+    report->stages[report->count].nanoseconds = nanoseconds;
+    report->stages[report->count++].nodes = nodes;
+}
@@ -0,0 +1,44 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include "ir/ir.h"
+
+#define BFC_MAX_PASSES 16
+
+/* root is set for the body of the program itself, which starts on a zeroed tape */
+typedef struct BFPassContext
+{
+    u32    cellMask;
+    BFBool root;
+} BFPassContext;
+
+/*
+ * A pass rewrites one block at a time and leaves the loops in it to be
+ * visited on their own. Every block is visited after the loops it holds, so
+ * a pass that looks into a loop's body sees it already rewritten by itself.
+ * level is the lowest optimization level the pass runs at. A pass returns
+ * BFC_FALSE if it runs out of memory, leaving the block as it was.
+ */
+typedef BFBool (*BFPassFn)(BFBlock *block, const BFPassContext *context);
+
+typedef struct BFPass
+{
+    const char *name;
+    BFOptLevel  level;
+    BFPassFn    run;
+} BFPass;
+
+/* passes run in the order they were added */
+typedef struct BFPassManager
+{
+    BFPass passes[BFC_MAX_PASSES];
+    size_t count;
+} BFPassManager;
+
+BFBool bfcInitPassManager(BFPassManager *manager);
+BFBool bfcAddPass(BFPassManager *manager, const char *name, BFOptLevel level, BFPassFn run);
+BFBool bfcRunPasses(const BFPassManager *manager, BFIrProgram *program, BFOptLevel level, BFCompileReport *report);
+
+void bfcReportStage(BFCompileReport *report, const char *name, u64 nanoseconds, size_t nodes);
+
+#endif /* PASSES_H */
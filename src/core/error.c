@@ -11,6 +11,17 @@
 
 static void bfvmPrintInternal(FILE *stream, const char *prefix, const char *fmt, va_list args);
 
+/* goes to stderr like the errors, so it never mixes with the program's output */
+void bfvmPrintInfo(const char *fmt, ...)
+{
+    const char *prefix = BFVM_ASCII_BOLD_CYAN "info:" BFVM_ASCII_RESET;
+    va_list args;
+
+    va_start(args, fmt);
+    bfvmPrintInternal(stderr, prefix, fmt, args);
+    va_end(args);
+}
+
 void bfvmPrintError(const char *fmt, ...)
 {
     const char *prefix = BFVM_ASCII_BOLD_RED "error:" BFVM_ASCII_RESET;
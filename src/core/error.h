@@ -9,6 +9,7 @@
 #   define BFVM_ASSERT(expr, ...) (void)0
 #endif
 
+void bfvmPrintInfo(const char *fmt, ...);
 void bfvmPrintError(const char *fmt, ...);
 void bfvmPanic(const char *fmt, ...);
 
@@ -40,3 +40,18 @@ void bfvmFree(void *ptr)
 {
     free(ptr);
 }
+
+void *bfvmTryMalloc(size_t numBytes)
+{
+    return malloc(numBytes);
+}
+
+void *bfvmTryCalloc(size_t numElements, size_t bytesPerElement)
+{
+    return calloc(numElements, bytesPerElement);
+}
+
+void *bfvmTryRealloc(void *ptr, size_t numBytes)
+{
+    return realloc(ptr, numBytes);
+}
@@ -8,9 +8,17 @@
 #define BFVM_REALLOC(T, P, N) (T *)bfvmRealloc(P, sizeof(T) * (N))
 #define BFVM_FREE(P)          bfvmFree(P)
 
+#define BFVM_TRY_MALLOC(T, N)     (T *)bfvmTryMalloc(sizeof(T) * (N))
+#define BFVM_TRY_CALLOC(T, N)     (T *)bfvmTryCalloc(N, sizeof(T))
+#define BFVM_TRY_REALLOC(T, P, N) (T *)bfvmTryRealloc(P, sizeof(T) * (N))
+
 void *bfvmMalloc(size_t numBytes);
 void *bfvmCalloc(size_t numElements, size_t bytesPerElement);
 void *bfvmRealloc(void *ptr, size_t numBytes);
 void bfvmFree(void *ptr);
 
+void *bfvmTryMalloc(size_t numBytes);
+void *bfvmTryCalloc(size_t numElements, size_t bytesPerElement);
+void *bfvmTryRealloc(void *ptr, size_t numBytes);
+
 #endif /* MEMORY_H */
@@ -11,6 +11,33 @@
 #   error "Unsupported platform"
 #endif
 
+#if defined(__x86_64__) || defined(_M_X64)
+#   define BFVM_ARCH_X86_64
+#endif
+
+#if defined(BFVM_LINUX) && defined(BFVM_ARCH_X86_64)
+#   define BFVM_JIT_SUPPORTED
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define BFVM_COMPUTED_GOTO
+#endif
+
+#if defined(BFVM_LINUX) || defined(BFVM_APPLE)
+#   define BFVM_GUARD_PAGES
+#endif
+
+/* JIT code does no bounds checks and relies on the guard pages to fault */
+#if defined(BFVM_JIT_SUPPORTED) && !defined(BFVM_GUARD_PAGES)
+#   error "The JIT requires guard pages"
+#endif
+
+#if defined(_MSC_VER)
+#   define BFVM_THREAD_LOCAL __declspec(thread)
+#else
+#   define BFVM_THREAD_LOCAL __thread
+#endif
+
 #if defined(DEBUG)
 #   define BFVM_DEBUG
 #elif defined(NDEBUG)
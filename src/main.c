@@ -1,16 +1,591 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "vm/analysis.h"
+#include "vm/batch.h"
 #include "vm/bfvm.h"
+#include "vm/profile.h"
+#include "vm/snapshot.h"
+
+#include "core/error.h"
+#include "core/memory.h"
 
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* the exit status of a program stopped by --fuel, apart from failures */
+#define BFVM_EXIT_OUT_OF_FUEL 2
+
+/* the virtual machine SIGUSR1 asks for statistics */
+static BFVirtualMachine *volatile s_Machine = NULL;
+
+static BFRunStatus bfvmRunCheckpointed(BFVirtualMachine *vm, const char *snapshotPath, u64 interval, u64 budget);
+static int bfvmRunBatchMain(const char *filepath, const BFCompileOptions *compileOptions, const BFRunOptions *options, const char *const *inputs, size_t count, size_t jobs);
+static void bfvmPrintCompileReport(const BFCompileReport *report, const char *filepath);
+static void bfvmRequestMachineStats(int signum);
+static char *bfvmOutputPath(const char *filepath, const char *extension);
+
+static BFBool bfvmParseTapeSize(const char *arg, size_t *size);
+static BFBool bfvmParseJobs(const char *arg, size_t *jobs);
+static BFBool bfvmParseCount(const char *arg, u64 *count);
+static BFBool bfvmParseCellBits(const char *arg, u8 *cellBits);
+static BFBool bfvmParseEofMode(const char *arg, BFEofMode *mode);
 
 int main(int argc, char **argv)
 {
-    BFVirtualMachine *const vm = bfvmInitVirtualMachine(argc, argv);
+    const char *filepath = NULL;
+    BFCompileOptions compileOptions = { BFC_OPT_PEEPHOLE, BFC_DEFAULT_CELL_BITS, getenv("BFVM_CACHE_DIR"), BF_FALSE, BFC_DEFAULT_PREFIX_STEPS, NULL };
+    BFCompileReport compileReport;
+    BFRunOptions options;
+    BFBool emit = BF_FALSE;
+    const char *emitPath = NULL;
+    BFBool emitC = BF_FALSE;
+    const char *emitCPath = NULL;
+    BFBool counted = BF_FALSE;
+    BFBool stats = BF_FALSE;
+    BFBool profiled = BF_FALSE;
+    const char *profilePath = NULL;
+    BFBool dumpAnalysis = BF_FALSE;
+    BFBool batch = BF_FALSE;
+    size_t jobs = 0;
+    u64 checkpointInterval = 0;
+    const char *checkpointPath = NULL;
+    const char *resumePath = NULL;
+    const char **inputs = BFVM_MALLOC(const char *, argc);
+    size_t inputCount = 0;
+
+    bfvmDefaultOptions(&options);
+    options.lineBuffered = bfvmOutputIsTerminal(BFVM_STDOUT_FD);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--jit") == 0)
+        {
+            options.engine = BFVM_ENGINE_JIT;
+        }
+        else if (strcmp(argv[i], "--threaded") == 0)
+        {
+            options.engine = BFVM_ENGINE_THREADED;
+        }
+        else if (strcmp(argv[i], "--batch") == 0)
+        {
+            batch = BF_TRUE;
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            if (!bfvmParseJobs(argv[i] + 7, &jobs))
+            {
+                bfvmPrintError("invalid job count: %s", argv[i] + 7);
+            }
+        }
+        else if (strncmp(argv[i], "--fuel=", 7) == 0)
+        {
+            if (!bfvmParseCount(argv[i] + 7, &options.fuel))
+            {
+                bfvmPrintError("invalid fuel: %s", argv[i] + 7);
+            }
+        }
+        else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0)
+        {
+            if (!bfvmParseCount(argv[i] + 19, &checkpointInterval))
+            {
+                bfvmPrintError("invalid checkpoint interval: %s", argv[i] + 19);
+            }
+        }
+        else if (strncmp(argv[i], "--checkpoint=", 13) == 0)
+        {
+            checkpointPath = argv[i] + 13;
+        }
+        else if (strncmp(argv[i], "--resume=", 9) == 0)
+        {
+            resumePath = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--count") == 0)
+        {
+            counted = BF_TRUE;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            stats = BF_TRUE;
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profiled = BF_TRUE;
+        }
+        else if (strncmp(argv[i], "--profile=", 10) == 0)
+        {
+            profiled = BF_TRUE;
+            profilePath = argv[i] + 10;
+        }
+        else if (strcmp(argv[i], "--dump-analysis") == 0)
+        {
+            dumpAnalysis = BF_TRUE;
+        }
+        else if (strcmp(argv[i], "-O0") == 0)
+        {
+            compileOptions.level = BFC_OPT_NONE;
+        }
+        else if (strcmp(argv[i], "-O1") == 0)
+        {
+            compileOptions.level = BFC_OPT_PEEPHOLE;
+        }
+        else if (strcmp(argv[i], "-O2") == 0)
+        {
+            compileOptions.level = BFC_OPT_DATAFLOW;
+        }
+        else if (strcmp(argv[i], "--time-passes") == 0)
+        {
+            compileReport.count = 0;
+            compileOptions.report = &compileReport;
+        }
+        else if (strncmp(argv[i], "--prefix-steps=", 15) == 0)
+        {
+            /* 0 turns the prefix off */
+            if (strcmp(argv[i] + 15, "0") == 0)
+            {
+                compileOptions.prefixSteps = 0;
+            }
+            else if (!bfvmParseCount(argv[i] + 15, &compileOptions.prefixSteps))
+            {
+                bfvmPrintError("invalid step count: %s", argv[i] + 15);
+            }
+        }
+        else if (strncmp(argv[i], "--tape-size=", 12) == 0)
+        {
+            if (!bfvmParseTapeSize(argv[i] + 12, &options.tapeSize))
+            {
+                bfvmPrintError("invalid tape size: %s", argv[i] + 12);
+            }
+        }
+        else if (strncmp(argv[i], "--cell-bits=", 12) == 0)
+        {
+            if (!bfvmParseCellBits(argv[i] + 12, &compileOptions.cellBits))
+            {
+                bfvmPrintError("invalid cell width: %s", argv[i] + 12);
+            }
+        }
+        else if (strcmp(argv[i], "--tape-unbounded") == 0)
+        {
+            options.growable = BF_TRUE;
+        }
+        else if (strncmp(argv[i], "--eof=", 6) == 0)
+        {
+            if (!bfvmParseEofMode(argv[i] + 6, &options.eof))
+            {
+                bfvmPrintError("invalid EOF mode: %s", argv[i] + 6);
+            }
+        }
+        else if (strcmp(argv[i], "--line-buffered") == 0)
+        {
+            options.lineBuffered = BF_TRUE;
+        }
+        else if (strncmp(argv[i], "--cache-dir=", 12) == 0)
+        {
+            compileOptions.cacheDir = argv[i] + 12;
+        }
+        else if (strcmp(argv[i], "--emit-bytecode") == 0)
+        {
+            emit = BF_TRUE;
+        }
+        else if (strncmp(argv[i], "--emit-bytecode=", 16) == 0)
+        {
+            emit = BF_TRUE;
+            emitPath = argv[i] + 16;
+        }
+        else if (strcmp(argv[i], "--emit-c") == 0)
+        {
+            emitC = BF_TRUE;
+        }
+        else if (strncmp(argv[i], "--emit-c=", 9) == 0)
+        {
+            emitC = BF_TRUE;
+            emitCPath = argv[i] + 9;
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
+        {
+            bfvmPrintError("unknown option: %s", argv[i]);
+        }
+        else if (!filepath)
+        {
+            filepath = argv[i];
+        }
+        else if (batch)
+        {
+            inputs[inputCount++] = argv[i];
+        }
+        else
+        {
+            bfvmPrintError("multiple sources given: %s", argv[i]);
+        }
+    }
+
+    if (!filepath)
+    {
+        bfvmPrintError("no sources");
+    }
+
+    if (compileOptions.cacheDir && compileOptions.cacheDir[0] == '\0')
+    {
+        compileOptions.cacheDir = NULL;
+    }
+
+    /* reports name loops by their position in the source */
+    compileOptions.sourceMap = profiled || dumpAnalysis;
+
+    /* counting and profiling need the dispatch loop, whatever engine was asked for */
+    if (batch && (counted || profiled || stats))
+    {
+        bfvmPrintError("--batch cannot be combined with --count, --stats or --profile");
+    }
+
+    if (batch && (checkpointInterval > 0 || resumePath))
+    {
+        bfvmPrintError("--batch cannot be combined with --checkpoint-every or --resume");
+    }
+
+    if (batch && inputCount == 0)
+    {
+        bfvmPrintError("--batch needs at least one input after the source");
+    }
+
+    if (batch && !emit && !emitC && !dumpAnalysis)
+    {
+        const int result = bfvmRunBatchMain(filepath, &compileOptions, &options, inputs, inputCount, jobs);
+        BFVM_FREE(inputs);
+        return result;
+    }
+
+    BFVM_FREE(inputs);
+
+    if (counted || profiled || stats)
+    {
+        options.engine = BFVM_ENGINE_PROFILED;
+    }
+
+    /* checkpoints are taken whenever a slice of the fuel runs out */
+    const u64 budget = options.fuel;
+    if (checkpointInterval > 0 && (budget == 0 || budget > checkpointInterval))
+    {
+        options.fuel = checkpointInterval;
+    }
+
+    BFVirtualMachine *const vm = bfvmLoadVirtualMachine(filepath, &compileOptions, &options, NULL);
     if (!vm)
     {
         return EXIT_FAILURE;
     }
 
-    bfvmRunVirtualMachine(vm);
+    bfvmPrintCompileReport(compileOptions.report, filepath);
+
+    if (dumpAnalysis)
+    {
+        BFAnalysis *const analysis = bfvmAnalyze(bfvmGetProgram(vm));
+        bfvmAnalysisReport(analysis, bfvmGetProgram(vm), filepath, stdout);
+        bfvmAnalysisFree(analysis);
+    }
+
+    /* emitting bytecode or C, or dumping the analysis, replaces running the program */
+    if (emit || emitC || dumpAnalysis)
+    {
+        BFBool saved = BF_TRUE;
+        if (emit)
+        {
+            char *const defaultPath = emitPath ? NULL : bfvmOutputPath(filepath, BFC_BYTECODE_EXTENSION);
+            saved = bfcSaveProgram(bfvmGetProgram(vm), emitPath ? emitPath : defaultPath);
+            BFVM_FREE(defaultPath);
+        }
+
+        if (saved && emitC)
+        {
+            char *const defaultPath = emitCPath ? NULL : bfvmOutputPath(filepath, BFC_C_EXTENSION);
+            saved = bfcEmitC(bfvmGetProgram(vm), filepath, emitCPath ? emitCPath : defaultPath);
+            BFVM_FREE(defaultPath);
+        }
+
+        bfvmCloseVirtualMachine(vm);
+        return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (resumePath)
+    {
+        const BFSnapshotStatus restored = bfvmRestoreSnapshot(vm, resumePath);
+        if (restored != BFVM_SNAPSHOT_OK)
+        {
+            bfvmPrintError("%s: %s", resumePath, bfvmSnapshotStatusMessage(restored));
+        }
+    }
+
+#if !defined(BFVM_WINDOWS)
+    if (stats)
+    {
+        s_Machine = vm;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = bfvmRequestMachineStats;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, NULL);
+    }
+#endif
+
+    char *const defaultSnapshotPath = (checkpointInterval > 0 && !checkpointPath) ? bfvmOutputPath(filepath, BFVM_SNAPSHOT_EXTENSION) : NULL;
+    const BFRunStatus status = (checkpointInterval > 0)
+        ? bfvmRunCheckpointed(vm, checkpointPath ? checkpointPath : defaultSnapshotPath, checkpointInterval, budget)
+        : bfvmRunVirtualMachine(vm);
+
+    BFVM_FREE(defaultSnapshotPath);
+
+    /* a program out of fuel stopped cleanly, so it still gets its reports */
+    if (status == BFVM_RUN_OUT_OF_FUEL)
+    {
+        bfvmPrintInfo("%s after %llu loop iterations", bfvmRunStatusMessage(status), (unsigned long long)budget);
+    }
+    else if (status != BFVM_RUN_OK)
+    {
+        bfvmPrintError("%s", bfvmRunStatusMessage(status));
+    }
+
+    if (counted)
+    {
+        bfvmPrintInfo("%llu instructions dispatched", (unsigned long long)bfvmDispatched(vm));
+    }
+
+    if (stats)
+    {
+        bfvmPrintStats(vm);
+    }
+
+    if (profiled)
+    {
+        char *const defaultPath = profilePath ? NULL : bfvmOutputPath(filepath, BFVM_PROFILE_EXTENSION);
+        const char *const path = profilePath ? profilePath : defaultPath;
+        if (!bfvmReportProfile(vm, path))
+        {
+            bfvmPrintError("could not write profile: %s", path);
+        }
+
+        BFVM_FREE(defaultPath);
+    }
+
     bfvmCloseVirtualMachine(vm);
+    return (status == BFVM_RUN_OUT_OF_FUEL) ? BFVM_EXIT_OUT_OF_FUEL : EXIT_SUCCESS;
+}
+
+/*
+ * Runs vm a slice of interval loop iterations at a time, which its fuel was
+ * set up for, and saves a snapshot in the background after each. budget is
+ * the --fuel for the whole run, 0 for none; once it is used up the run stops
+ * after a last snapshot. A snapshot that could not be written is reported,
+ * but the run goes on.
+ */
+static BFRunStatus bfvmRunCheckpointed(BFVirtualMachine *vm, const char *snapshotPath, u64 interval, u64 budget)
+{
+    u64 slice = (budget > 0 && budget < interval) ? budget : interval;
+    u64 left = budget;
+    BFRunStatus status = BFVM_RUN_OK;
+
+    for (;;)
+    {
+        status = bfvmRunVirtualMachine(vm);
+        if (status != BFVM_RUN_OUT_OF_FUEL)
+        {
+            break;
+        }
+
+        if (!bfvmSaveSnapshot(vm, snapshotPath, BF_TRUE))
+        {
+            bfvmPrintInfo("could not write snapshot: %s", snapshotPath);
+        }
+
+        if (budget > 0)
+        {
+            left -= slice;
+            if (left == 0)
+            {
+                break;
+            }
+        }
+
+        slice = (left > 0 && left < interval) ? left : interval;
+        bfvmRefuel(vm, slice);
+    }
+
+    if (!bfvmWaitSnapshot(vm))
+    {
+        bfvmPrintInfo("could not write snapshot: %s", snapshotPath);
+    }
+
+    return status;
+}
+
+/* failed inputs are reported once all outputs are written */
+static int bfvmRunBatchMain(const char *filepath, const BFCompileOptions *compileOptions, const BFRunOptions *options, const char *const *inputs, size_t count, size_t jobs)
+{
+    BFProgram *const program = bfvmLoadProgram(filepath, compileOptions, NULL);
+    if (!program)
+    {
+        return EXIT_FAILURE;
+    }
+
+    bfvmPrintCompileReport(compileOptions->report, filepath);
+
+    BFRunStatus *const statuses = BFVM_MALLOC(BFRunStatus, count + 1);
+    const BFBool written = bfvmRunBatch(program, filepath, options, inputs, count, jobs, statuses);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (statuses[i] != BFVM_RUN_OK)
+        {
+            bfvmPrintInfo("%s: %s", inputs[i], bfvmRunStatusMessage(statuses[i]));
+            failed++;
+        }
+    }
+
+    BFVM_FREE(statuses);
+    bfcFreeProgram(program);
+
+    if (!written)
+    {
+        bfvmPrintError("failed to write output");
+    }
+
+    if (failed > 0)
+    {
+        bfvmPrintError("%zu of %zu inputs failed", failed, count);
+    }
+
     return EXIT_SUCCESS;
 }
+
+/* bytecode images are not compiled, so they have no stages to report */
+static void bfvmPrintCompileReport(const BFCompileReport *report, const char *filepath)
+{
+    if (!report)
+    {
+        return;
+    }
+
+    if (report->count == 0)
+    {
+        bfvmPrintInfo("no passes ran for %s", filepath);
+        return;
+    }
+
+    u64 total = 0;
+    bfvmPrintInfo("passes of %s", filepath);
+    fprintf(stderr, "\n  %-16s %13s %12s\n", "stage", "time", "size");
+    for (size_t i = 0; i < report->count; i++)
+    {
+        const BFStageTiming *const stage = &report->stages[i];
+        fprintf(stderr, "  %-16s %10.3f ms %12zu\n", stage->name, (double)stage->nanoseconds / 1e6, stage->nodes);
+        total += stage->nanoseconds;
+    }
+
+    fprintf(stderr, "  %-16s %10.3f ms\n\n", "total", (double)total / 1e6);
+}
+
+static void bfvmRequestMachineStats(int signum)
+{
+    (void)signum;
+
+    if (s_Machine)
+    {
+        bfvmRequestStats(s_Machine);
+    }
+}
+
+/* prog.b becomes prog.bfbc, prog.c, prog.folded or prog.bfsnap; other names get the extension appended */
+static char *bfvmOutputPath(const char *filepath, const char *extension)
+{
+    size_t length = strlen(filepath);
+    if (length > 2 && strcmp(filepath + length - 2, ".b") == 0)
+    {
+        length -= 2;
+    }
+
+    const size_t size = length + strlen(extension) + 1;
+    char *const path = BFVM_MALLOC(char, size);
+    memcpy(path, filepath, length);
+    strcpy(path + length, extension);
+
+    return path;
+}
+
+static BFBool bfvmParseTapeSize(const char *arg, size_t *size)
+{
+    char *end = NULL;
+    const unsigned long long value = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0' || value == 0 || value > SIZE_MAX)
+    {
+        return BF_FALSE;
+    }
+
+    *size = (size_t)value;
+    return BF_TRUE;
+}
+
+/* 0 stands for one job per core */
+static BFBool bfvmParseJobs(const char *arg, size_t *jobs)
+{
+    char *end = NULL;
+    const unsigned long long value = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0' || value > SIZE_MAX)
+    {
+        return BF_FALSE;
+    }
+
+    *jobs = (size_t)value;
+    return BF_TRUE;
+}
+
+/* a count of at least 1 */
+static BFBool bfvmParseCount(const char *arg, u64 *count)
+{
+    char *end = NULL;
+    const unsigned long long value = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0' || value == 0)
+    {
+        return BF_FALSE;
+    }
+
+    *count = (u64)value;
+    return BF_TRUE;
+}
+
+static BFBool bfvmParseCellBits(const char *arg, u8 *cellBits)
+{
+    if (strcmp(arg, "8") == 0 || strcmp(arg, "16") == 0 || strcmp(arg, "32") == 0)
+    {
+        *cellBits = (u8)atoi(arg);
+        return BF_TRUE;
+    }
+
+    return BF_FALSE;
+}
+
+static BFBool bfvmParseEofMode(const char *arg, BFEofMode *mode)
+{
+    if (strcmp(arg, "unchanged") == 0)
+    {
+        *mode = BFVM_EOF_UNCHANGED;
+    }
+    else if (strcmp(arg, "0") == 0)
+    {
+        *mode = BFVM_EOF_ZERO;
+    }
+    else if (strcmp(arg, "-1") == 0)
+    {
+        *mode = BFVM_EOF_MINUS_ONE;
+    }
+    else
+    {
+        return BF_FALSE;
+    }
+
+    return BF_TRUE;
+}
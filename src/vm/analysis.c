@@ -0,0 +1,189 @@
+#include "analysis.h"
+#include "profile.h"
+
+#include "core/memory.h"
+
+/* a loop being analyzed, with the data pointer relative to where its iteration started */
+typedef struct BFAnalysisFrame
+{
+    size_t loop;
+    i64    offset;
+    i64    minOffset;
+    i64    maxOffset;
+    BFBool known;
+} BFAnalysisFrame;
+
+static const char *const s_KindNames[] = {
+    [BFVM_LOOP_BALANCED] = "balanced",
+    [BFVM_LOOP_DRIFTING] = "drifting",
+    [BFVM_LOOP_UNKNOWN]  = "unknown"
+};
+
+static void bfvmAnalysisOpen(BFAnalysis *analysis, BFAnalysisFrame *frames, size_t *depth, size_t ip);
+static void bfvmAnalysisClose(BFAnalysis *analysis, const BFAnalysisFrame *inner, BFAnalysisFrame *outer, size_t exit);
+static void bfvmAnalysisTouch(BFAnalysisFrame *frame, i64 offset);
+
+/*
+ * Classifies every loop in one pass over the program. A loop only learns
+ * whether it is balanced at its JNZ, so the range of an inner loop is added
+ * to the loop around it there, shifted to where the inner loop started.
+ */
+BFAnalysis *bfvmAnalyze(const BFProgram *program)
+{
+    BFAnalysis *const analysis = BFVM_MALLOC(BFAnalysis, 1);
+    analysis->loops = BFVM_MALLOC(BFLoopInfo, program->loopCount + 1);
+    analysis->loopCount = 0;
+    analysis->balancedCount = 0;
+    analysis->loopAt = BFVM_CALLOC(size_t, program->size + 1);
+
+    /* frames[0] is the code outside every loop */
+    BFAnalysisFrame *const frames = BFVM_CALLOC(BFAnalysisFrame, program->loopCount + 1);
+    size_t depth = 0;
+
+    for (size_t ip = 0; ip < program->size; ip += BFC_WIDTH(program->code[ip]))
+    {
+        const BFOpCode op = program->code[ip];
+        BFAnalysisFrame *const frame = &frames[depth];
+
+        switch (BFC_INSTR(op))
+        {
+            case BFC_ADDB:
+            case BFC_SUBB:
+            case BFC_WRITE:
+            case BFC_READ:
+            case BFC_SET:
+                bfvmAnalysisTouch(frame, frame->offset + BFC_OFFSET(op));
+                break;
+            case BFC_ADDP:
+                frame->offset += BFC_OPERAND(op);
+                bfvmAnalysisTouch(frame, frame->offset);
+                break;
+            case BFC_SUBP:
+                frame->offset -= BFC_OPERAND(op);
+                bfvmAnalysisTouch(frame, frame->offset);
+                break;
+            case BFC_SCAN:
+                frame->known = BF_FALSE;
+                break;
+            case BFC_MUL:
+                bfvmAnalysisTouch(frame, frame->offset + BFC_OFFSET(op));
+                bfvmAnalysisTouch(frame, frame->offset + BFC_MUL_TARGET(program->code, ip));
+                break;
+            case BFC_JZ:
+                bfvmAnalysisTouch(frame, frame->offset);
+                bfvmAnalysisOpen(analysis, frames, &depth, ip);
+                break;
+            case BFC_JNZ:
+                bfvmAnalysisTouch(frame, frame->offset);
+                depth--;
+                bfvmAnalysisClose(analysis, frame, &frames[depth], ip + BFC_JUMP_WIDTH(op));
+                break;
+            default:
+                break;
+        }
+    }
+
+    BFVM_FREE(frames);
+    return analysis;
+}
+
+void bfvmAnalysisFree(BFAnalysis *analysis)
+{
+    BFVM_FREE(analysis->loopAt);
+    BFVM_FREE(analysis->loops);
+    BFVM_FREE(analysis);
+}
+
+/* prints every loop in program order, in the table format of the profile report */
+void bfvmAnalysisReport(const BFAnalysis *analysis, const BFProgram *program, const char *programName, FILE *file)
+{
+    fprintf(file, "analysis of %s: %zu loops, %zu balanced\n", programName, analysis->loopCount, analysis->balancedCount);
+    fprintf(file, "\n  %-16s %6s %-10s %10s %10s %10s\n", "loop", "depth", "kind", "delta", "min", "max");
+
+    for (size_t i = 0; i < analysis->loopCount; i++)
+    {
+        const BFLoopInfo *const loop = &analysis->loops[i];
+
+        char location[BFVM_LOCATION_SIZE];
+        bfvmProfileLocate(program, loop->open, location);
+
+        if (loop->kind == BFVM_LOOP_UNKNOWN)
+        {
+            fprintf(file, "  %-16s %6zu %-10s %10s %10s %10s\n", location, loop->depth, s_KindNames[loop->kind], "-", "-", "-");
+        }
+        else
+        {
+            fprintf(file, "  %-16s %6zu %-10s %+10lld %+10lld %+10lld\n",
+                    location,
+                    loop->depth,
+                    s_KindNames[loop->kind],
+                    (long long)loop->delta,
+                    (long long)loop->minOffset,
+                    (long long)loop->maxOffset);
+        }
+    }
+
+    fprintf(file, "\n");
+}
+
+static void bfvmAnalysisOpen(BFAnalysis *analysis, BFAnalysisFrame *frames, size_t *depth, size_t ip)
+{
+    BFLoopInfo *const loop = &analysis->loops[analysis->loopCount];
+    loop->open = ip;
+    loop->depth = *depth + 1;
+
+    BFAnalysisFrame *const frame = &frames[++*depth];
+    frame->loop = analysis->loopCount;
+    frame->offset = 0;
+    frame->minOffset = 0;
+    frame->maxOffset = 0;
+    frame->known = BF_TRUE;
+
+    analysis->loopAt[ip] = analysis->loopCount++;
+}
+
+/* where any other loop leaves the data pointer depends on the tape, so the loop around it cannot know either */
+static void bfvmAnalysisClose(BFAnalysis *analysis, const BFAnalysisFrame *inner, BFAnalysisFrame *outer, size_t exit)
+{
+    BFLoopInfo *const loop = &analysis->loops[inner->loop];
+    loop->exit = exit;
+    loop->delta = inner->offset;
+    loop->minOffset = inner->minOffset;
+    loop->maxOffset = inner->maxOffset;
+
+    if (!inner->known)
+    {
+        loop->kind = BFVM_LOOP_UNKNOWN;
+    }
+    else if (inner->offset != 0)
+    {
+        loop->kind = BFVM_LOOP_DRIFTING;
+    }
+    else
+    {
+        loop->kind = BFVM_LOOP_BALANCED;
+        analysis->balancedCount++;
+    }
+
+    if (loop->kind == BFVM_LOOP_BALANCED)
+    {
+        bfvmAnalysisTouch(outer, outer->offset + loop->minOffset);
+        bfvmAnalysisTouch(outer, outer->offset + loop->maxOffset);
+    }
+    else
+    {
+        outer->known = BF_FALSE;
+    }
+}
+
+static void bfvmAnalysisTouch(BFAnalysisFrame *frame, i64 offset)
+{
+    if (offset < frame->minOffset)
+    {
+        frame->minOffset = offset;
+    }
+    else if (offset > frame->maxOffset)
+    {
+        frame->maxOffset = offset;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "core/types.h"
+
+#include <bfc/bfc.h>
+
+#include <stdio.h>
+
+/*
+ * What one iteration of a loop does to the data pointer. A loop is unknown
+ * when it holds a scan or a loop that is not balanced, as where those leave
+ * the data pointer depends on the tape. Otherwise delta is how far one
+ * iteration moves it, and a loop that does not move it at all is balanced:
+ * every iteration starts at the same cell and touches the same range.
+ */
+typedef enum BFLoopKind
+{
+    BFVM_LOOP_BALANCED,
+    BFVM_LOOP_DRIFTING,
+    BFVM_LOOP_UNKNOWN
+} BFLoopKind;
+
+/*
+ * A loop from its JZ at open to the instruction after its JNZ at exit.
+ * minOffset and maxOffset bound the cells an iteration touches or moves the
+ * data pointer to, relative to the cell it started at, those of the loops
+ * inside it included; they mean nothing for an unknown loop.
+ */
+typedef struct BFLoopInfo
+{
+    size_t     open;
+    size_t     exit;
+    size_t     depth;
+    BFLoopKind kind;
+    i64        delta;
+    i64        minOffset;
+    i64        maxOffset;
+} BFLoopInfo;
+
+/* loops are in the order of their JZ; loopAt maps the word of a JZ to its loop */
+typedef struct BFAnalysis
+{
+    BFLoopInfo *loops;
+    size_t      loopCount;
+    size_t      balancedCount;
+    size_t     *loopAt;
+} BFAnalysis;
+
+BFAnalysis *bfvmAnalyze(const BFProgram *program);
+void bfvmAnalysisFree(BFAnalysis *analysis);
+
+void bfvmAnalysisReport(const BFAnalysis *analysis, const BFProgram *program, const char *programName, FILE *file);
+
+#endif /* ANALYSIS_H */
@@ -0,0 +1,434 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "batch.h"
+
+#include "output.h"
+
+#include "core/memory.h"
+#include "core/platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Windows runs the inputs one after another, so the input running there is
+ * always next in line and nothing ever has to wait.
+ */
+#if defined(BFVM_WINDOWS)
+typedef int BFMutex;
+typedef int BFCondition;
+#   define BFVM_MUTEX_INIT(M)        (void)(M)
+#   define BFVM_MUTEX_DESTROY(M)     (void)(M)
+#   define BFVM_LOCK(M)              (void)(M)
+#   define BFVM_UNLOCK(M)            (void)(M)
+#   define BFVM_CONDITION_INIT(C)    (void)(C)
+#   define BFVM_CONDITION_DESTROY(C) (void)(C)
+#   define BFVM_WAIT(C, M)           ((void)(C), (void)(M))
+#   define BFVM_BROADCAST(C)         (void)(C)
+#else
+#   include <pthread.h>
+#   include <unistd.h>
+typedef pthread_mutex_t BFMutex;
+typedef pthread_cond_t BFCondition;
+#   define BFVM_MUTEX_INIT(M)        pthread_mutex_init(M, NULL)
+#   define BFVM_MUTEX_DESTROY(M)     pthread_mutex_destroy(M)
+#   define BFVM_LOCK(M)              pthread_mutex_lock(M)
+#   define BFVM_UNLOCK(M)            pthread_mutex_unlock(M)
+#   define BFVM_CONDITION_INIT(C)    pthread_cond_init(C, NULL)
+#   define BFVM_CONDITION_DESTROY(C) pthread_cond_destroy(C)
+#   define BFVM_WAIT(C, M)           pthread_cond_wait(C, M)
+#   define BFVM_BROADCAST(C)         pthread_cond_broadcast(C)
+#endif
+
+/* most output an input holds back before its worker waits for its turn, in bytes */
+#define BFVM_BATCH_HELD_LIMIT ((size_t)1 << 24)
+
+/*
+ * The output of one input, held until every earlier output is written. Once
+ * the input is next in line its worker writes the held output and then
+ * writes straight to the batch output as the program runs.
+ */
+typedef struct BFBatchJob
+{
+    const char *path;
+    u8         *output;
+    size_t      size;
+    size_t      capacity;
+    BFBool      direct;
+    BFBool      done;
+} BFBatchJob;
+
+struct BFBatch;
+
+/*
+ * The queue of a worker holds the inputs index + k * workerCount for every k
+ * in [head, tail). The worker takes them from the head, in the order their
+ * outputs are written, and other workers steal from the tail.
+ */
+typedef struct BFBatchWorker
+{
+    struct BFBatch *batch;
+    size_t          index;
+    size_t          head;
+    size_t          tail;
+    BFMutex         lock;
+    BFBatchJob     *job;
+    FILE           *file;
+#if !defined(BFVM_WINDOWS)
+    pthread_t       thread;
+#endif
+} BFBatchWorker;
+
+/*
+ * next is the first input whose output is not written yet, and turn is
+ * signalled whenever it may have moved on.
+ */
+typedef struct BFBatch
+{
+    const BFProgram *program;
+    const char      *name;
+    BFRunOptions     options;
+    BFBatchJob      *jobs;
+    BFRunStatus     *statuses;
+    size_t           count;
+    BFBatchWorker   *workers;
+    size_t           workerCount;
+    BFOutput        *output;
+    size_t           next;
+    BFBool           writing;
+    BFBool           failed;
+    BFMutex          lock;
+    BFCondition      turn;
+} BFBatch;
+
+static void *bfvmBatchWork(void *context);
+static BFBool bfvmBatchNext(BFBatchWorker *worker, size_t *index);
+static void bfvmBatchFinish(BFBatch *batch, size_t index, BFRunStatus status);
+static BFBool bfvmBatchIsNext(const BFBatch *batch, const BFBatchJob *job);
+static BFBool bfvmBatchPut(BFBatch *batch, const u8 *data, size_t size);
+static long bfvmBatchRead(void *context, u8 *buffer, size_t size);
+static BFBool bfvmBatchWrite(void *context, const u8 *data, size_t size);
+static BFBool bfvmBatchHold(BFBatchJob *job, const u8 *data, size_t size);
+static size_t bfvmBatchCores(void);
+
+BFBool bfvmRunBatch(const BFProgram *program, const char *name, const BFRunOptions *options, const char *const *inputs, size_t count, size_t jobs, BFRunStatus *statuses)
+{
+    if (count == 0)
+    {
+        return BF_TRUE;
+    }
+
+#if defined(BFVM_WINDOWS)
+    jobs = 1;
+#endif
+
+    if (jobs == 0)
+    {
+        jobs = bfvmBatchCores();
+    }
+
+    BFBatch batch;
+    batch.program = program;
+    batch.name = name;
+    batch.options = *options;
+    batch.jobs = BFVM_CALLOC(BFBatchJob, count);
+    batch.statuses = statuses;
+    batch.count = count;
+    batch.workerCount = (jobs < count) ? jobs : count;
+    batch.workers = BFVM_CALLOC(BFBatchWorker, batch.workerCount);
+    batch.output = options->write
+        ? bfvmOutputCreateWriter(options->write, options->writeContext, options->lineBuffered)
+        : bfvmOutputCreate(BFVM_STDOUT_FD, options->lineBuffered);
+    batch.next = 0;
+    batch.writing = BF_FALSE;
+    batch.failed = BF_FALSE;
+    BFVM_MUTEX_INIT(&batch.lock);
+    BFVM_CONDITION_INIT(&batch.turn);
+
+    /* workers collect their output in memory, so line buffering would only slow them down */
+    batch.options.lineBuffered = BF_FALSE;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        batch.jobs[i].path = inputs[i];
+    }
+
+    const size_t workerCount = batch.workerCount;
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        batch.workers[i].batch = &batch;
+        BFVM_MUTEX_INIT(&batch.workers[i].lock);
+    }
+
+    /*
+     * The calling thread is the last worker, after as many threads as could be
+     * started. The queues are only dealt out once that number is known, under
+     * the lock the started threads wait on first, so every queue has a worker
+     * taking from its head: the input next in line is then always running or
+     * about to, and a worker waiting for its turn is never waiting forever.
+     */
+    BFVM_LOCK(&batch.lock);
+
+    size_t started = 0;
+#if !defined(BFVM_WINDOWS)
+    while (started + 1 < workerCount && pthread_create(&batch.workers[started].thread, NULL, bfvmBatchWork, &batch.workers[started]) == 0)
+    {
+        started++;
+    }
+#endif
+
+    batch.workerCount = started + 1;
+    for (size_t i = 0; i < batch.workerCount; i++)
+    {
+        BFBatchWorker *const worker = &batch.workers[i];
+        worker->index = i;
+        worker->head = 0;
+        worker->tail = (count - i + batch.workerCount - 1) / batch.workerCount;
+    }
+
+    BFVM_UNLOCK(&batch.lock);
+
+    bfvmBatchWork(&batch.workers[started]);
+
+#if !defined(BFVM_WINDOWS)
+    for (size_t i = 0; i < started; i++)
+    {
+        pthread_join(batch.workers[i].thread, NULL);
+    }
+#endif
+
+    const BFBool written = bfvmOutputFlush(batch.output) && !batch.failed;
+
+    for (size_t i = 0; i < workerCount; i++)
+    {
+        BFVM_MUTEX_DESTROY(&batch.workers[i].lock);
+    }
+
+    BFVM_CONDITION_DESTROY(&batch.turn);
+    BFVM_MUTEX_DESTROY(&batch.lock);
+    bfvmOutputFree(batch.output);
+    BFVM_FREE(batch.workers);
+    BFVM_FREE(batch.jobs);
+
+    return written;
+}
+
+/*
+ * One virtual machine runs every input the worker gets, so its tape, buffers
+ * and compiled code are only set up once. A worker that has no memory for one
+ * still takes its inputs, ending each as out of memory, since the inputs
+ * after them would wait on them otherwise.
+ */
+static void *bfvmBatchWork(void *context)
+{
+    BFBatchWorker *const worker = (BFBatchWorker *)context;
+    BFBatch *const batch = worker->batch;
+
+    /* the queues are dealt out by the time the calling thread lets go of the lock */
+    BFVM_LOCK(&batch->lock);
+    BFVM_UNLOCK(&batch->lock);
+
+    BFRunOptions options = batch->options;
+    options.read = bfvmBatchRead;
+    options.readContext = worker;
+    options.write = bfvmBatchWrite;
+    options.writeContext = worker;
+
+    BFVirtualMachine *const vm = bfvmCreateSharedVirtualMachine(batch->program, batch->name, &options);
+
+    size_t index = 0;
+    while (bfvmBatchNext(worker, &index))
+    {
+        BFRunStatus status = vm ? BFVM_RUN_READ_ERROR : BFVM_RUN_OUT_OF_MEMORY;
+
+        worker->job = &batch->jobs[index];
+        worker->file = vm ? fopen(worker->job->path, "rb") : NULL;
+        if (worker->file)
+        {
+            bfvmResetVirtualMachine(vm);
+            status = bfvmRunVirtualMachine(vm);
+            fclose(worker->file);
+        }
+
+        bfvmBatchFinish(batch, index, status);
+    }
+
+    if (vm)
+    {
+        bfvmCloseVirtualMachine(vm);
+    }
+
+    return NULL;
+}
+
+/* the worker's own queue first, then the others in turn */
+static BFBool bfvmBatchNext(BFBatchWorker *worker, size_t *index)
+{
+    BFBatch *const batch = worker->batch;
+    for (size_t i = 0; i < batch->workerCount; i++)
+    {
+        BFBatchWorker *const queue = &batch->workers[(worker->index + i) % batch->workerCount];
+        BFBool found = BF_FALSE;
+
+        BFVM_LOCK(&queue->lock);
+        if (queue->head < queue->tail)
+        {
+            const size_t k = (queue == worker) ? queue->head++ : --queue->tail;
+            *index = queue->index + k * batch->workerCount;
+            found = BF_TRUE;
+        }
+        BFVM_UNLOCK(&queue->lock);
+
+        if (found)
+        {
+            return BF_TRUE;
+        }
+    }
+
+    return BF_FALSE;
+}
+
+/*
+ * Marks an input as done and writes every output that is now next in line.
+ * Only one worker writes at a time, and it does so without holding the lock,
+ * so the others keep running meanwhile. The input it stops at starts writing
+ * its own output once it is told its turn came.
+ */
+static void bfvmBatchFinish(BFBatch *batch, size_t index, BFRunStatus status)
+{
+    BFVM_LOCK(&batch->lock);
+    batch->statuses[index] = status;
+    batch->jobs[index].done = BF_TRUE;
+
+    if (batch->writing)
+    {
+        BFVM_UNLOCK(&batch->lock);
+        return;
+    }
+
+    batch->writing = BF_TRUE;
+    while (batch->next < batch->count && batch->jobs[batch->next].done)
+    {
+        BFBatchJob *const job = &batch->jobs[batch->next++];
+        BFVM_UNLOCK(&batch->lock);
+
+        bfvmBatchPut(batch, job->output, job->size);
+        BFVM_FREE(job->output);
+        job->output = NULL;
+
+        BFVM_LOCK(&batch->lock);
+    }
+
+    batch->writing = BF_FALSE;
+    BFVM_BROADCAST(&batch->turn);
+    BFVM_UNLOCK(&batch->lock);
+}
+
+/* whether the output of job can be written now; called with the lock held */
+static BFBool bfvmBatchIsNext(const BFBatch *batch, const BFBatchJob *job)
+{
+    return !batch->writing && batch->next < batch->count && &batch->jobs[batch->next] == job;
+}
+
+/* only called by the one worker allowed to write at the time */
+static BFBool bfvmBatchPut(BFBatch *batch, const u8 *data, size_t size)
+{
+    if (!bfvmOutputWrite(batch->output, data, size)
+        || (batch->output->lineBuffered && !bfvmOutputFlush(batch->output)))
+    {
+        batch->failed = BF_TRUE;
+        return BF_FALSE;
+    }
+
+    return BF_TRUE;
+}
+
+static long bfvmBatchRead(void *context, u8 *buffer, size_t size)
+{
+    FILE *const file = ((BFBatchWorker *)context)->file;
+    const size_t count = fread(buffer, 1, size, file);
+    if (count == 0 && ferror(file))
+    {
+        return -1;
+    }
+
+    return (long)count;
+}
+
+/*
+ * Holds the output back until the input is next in line, waiting for that
+ * once BFVM_BATCH_HELD_LIMIT is held, then writes the held output and
+ * everything after it straight through.
+ */
+static BFBool bfvmBatchWrite(void *context, const u8 *data, size_t size)
+{
+    BFBatchWorker *const worker = (BFBatchWorker *)context;
+    BFBatch *const batch = worker->batch;
+    BFBatchJob *const job = worker->job;
+
+    if (!job->direct)
+    {
+        BFVM_LOCK(&batch->lock);
+        while (job->size + size > BFVM_BATCH_HELD_LIMIT && !bfvmBatchIsNext(batch, job))
+        {
+            BFVM_WAIT(&batch->turn, &batch->lock);
+        }
+
+        job->direct = bfvmBatchIsNext(batch, job);
+        BFVM_UNLOCK(&batch->lock);
+
+        if (!job->direct)
+        {
+            return bfvmBatchHold(job, data, size);
+        }
+
+        const BFBool held = bfvmBatchPut(batch, job->output, job->size);
+        BFVM_FREE(job->output);
+        job->output = NULL;
+        job->size = 0;
+
+        if (!held)
+        {
+            return BF_FALSE;
+        }
+    }
+
+    return bfvmBatchPut(batch, data, size);
+}
+
+static BFBool bfvmBatchHold(BFBatchJob *job, const u8 *data, size_t size)
+{
+    if (job->size + size > job->capacity)
+    {
+        size_t capacity = (job->capacity > 0) ? job->capacity : BFVM_OUTPUT_BUFFER_SIZE;
+        while (job->size + size > capacity)
+        {
+            capacity *= 2;
+        }
+
+        u8 *const output = BFVM_TRY_REALLOC(u8, job->output, capacity);
+        if (!output)
+        {
+            return BF_FALSE;
+        }
+
+        job->output = output;
+        job->capacity = capacity;
+    }
+
+    memcpy(job->output + job->size, data, size);
+    job->size += size;
+    return BF_TRUE;
+}
+
+static size_t bfvmBatchCores(void)
+{
+#if defined(BFVM_WINDOWS)
+    return 1;
+#else
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cores > 0) ? (size_t)cores : 1;
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "bfvm.h"
+
+/*
+ * Runs program once for every file in inputs, which the program reads as its
+ * input, on jobs worker threads, or one per core when jobs is 0. Each worker
+ * runs one virtual machine of its own over the shared program and takes its
+ * inputs from a queue of its own, stealing from the others once that runs
+ * dry. Windows has no worker threads, so there the inputs run one after
+ * another on the calling thread.
+ *
+ * The outputs are written one after another in the order of inputs, through
+ * options->write or to the standard output. The input next in line writes its
+ * output as it runs; later ones hold theirs back until all earlier ones are
+ * done, and a worker holding 16 MiB waits for its input's turn before going
+ * on. options->read is ignored. statuses receives how the run of each input
+ * ended, a file that could not be read being a read error and one taken by
+ * a worker with no memory for a virtual machine being out of memory. Returns
+ * BF_FALSE if writing the outputs failed.
+ */
+BFBool bfvmRunBatch(const BFProgram *program, const char *name, const BFRunOptions *options, const char *const *inputs, size_t count, size_t jobs, BFRunStatus *statuses);
+
+#endif /* BATCH_H */
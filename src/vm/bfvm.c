@@ -1,159 +1,736 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
 #include "bfvm.h"
 
+#include "analysis.h"
+#include "input.h"
+#include "jit.h"
+#include "output.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "tape.h"
+
 #include "core/error.h"
 #include "core/memory.h"
 
 #include <bfc/bfc.h>
+#include <bfc/core/clock.h>
 
+#include <setjmp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+
+#define BFVM_DEFAULT_NAME "<program>"
+
+/* more back-edges than any run will ever take */
+#define BFVM_UNLIMITED_FUEL UINT64_MAX
+
+typedef struct BFThreadedOp
+{
+    const void *handler;
+    union
+    {
+        const struct BFThreadedOp *target;
+        size_t                     value;
+        ptrdiff_t                  step;
+        struct
+        {
+            ptrdiff_t offset;
+            u32       value;
+        } cell;
+        struct
+        {
+            ptrdiff_t offset;
+            ptrdiff_t target;
+            u32       factor;
+        } mulAdd;
+    } operand;
+} BFThreadedOp;
 
-#define BFVM_DATA_SIZE 30000
+typedef void (*BFRunFn)(BFVirtualMachine *vm);
 
+/*
+ * Everything a run touches lives here, so virtual machines never share state.
+ * The program is only read, so it can be shared; owned is set when it is
+ * the virtual machine's to free. statsRequested is the one field written
+ * from outside the running thread. analysis only exists without guard pages,
+ * where it tells the switch loop which loops it may run unchecked.
+ * prefixPending is set until the next run has started, from the program's
+ * prefix or not.
+ * A run that fails midway stores its status and jumps back to abort.
+ */
 struct BFVirtualMachine
 {
-    u8              data[BFVM_DATA_SIZE];
-    const BFOpCode *code;
-    size_t          ip;
-    u16             dp;
+    BFTape                *tape;
+    BFInput               *input;
+    BFOutput              *output;
+    const BFProgram       *program;
+    BFProgram             *owned;
+    const BFOpCode        *code;
+    BFJitCode             *jit;
+    BFThreadedOp          *threaded;
+    BFAnalysis            *analysis;
+    BFRunFn                run;
+    size_t                 ip;
+    size_t                 dp;
+    u64                    fuel;
+    u64                    budget;
+    BFEofMode              eof;
+    BFProfile             *profile;
+    char                  *name;
+    u64                    compileTime;
+    u64                    runStart;
+    long                   snapshotWriter;
+    BFBool                 prefixPending;
+    volatile sig_atomic_t  statsRequested;
+    BFRunStatus            status;
+    jmp_buf                abort;
 };
 
-static void bfvmAddb(BFVirtualMachine *vm, u8 val);
-static void bfvmSubb(BFVirtualMachine *vm, u8 val);
-static void bfvmAddp(BFVirtualMachine *vm, u16 val);
-static void bfvmSubp(BFVirtualMachine *vm, u16 val);
-static void bfvmWrite(BFVirtualMachine *vm);
-static void bfvmRead(BFVirtualMachine *vm);
-static void bfvmJz(BFVirtualMachine *vm, size_t line);
-static void bfvmJmp(BFVirtualMachine *vm, size_t line);
+static BFVirtualMachine *bfvmCreateFailed(BFProgram *program, const char *name, BFCompileStatus *status);
+static void bfvmRunJit(BFVirtualMachine *vm);
+
+static void bfvmStartFromPrefix(BFVirtualMachine *vm);
+static void bfvmTrackPointer(BFVirtualMachine *vm);
+static BFBool bfvmIsInstruction(const BFProgram *program, u64 ip);
+
+static BFRunFn bfvmSelectInterpreter(BFEngine engine, u8 cellBits);
+
+static void bfvmAbort(BFVirtualMachine *vm, BFRunStatus status);
+#if !defined(BFVM_GUARD_PAGES)
+static void bfvmOutOfRange(BFVirtualMachine *vm);
+#endif
+static void bfvmOutOfFuel(BFVirtualMachine *vm);
+static void bfvmAddp(BFVirtualMachine *vm, u32 val);
+static void bfvmSubp(BFVirtualMachine *vm, u32 val);
+
+static void bfvmPutByte(BFVirtualMachine *vm, u8 byte, size_t count);
+static BFBool bfvmGetByte(BFVirtualMachine *vm, u8 *byte);
+static void bfvmWriteCell(void *context, u8 *cell, u32 count);
+static void bfvmReadCell(void *context, u8 *cell, u32 count);
+
+#define BFVM_CELL          u8
+#define BFVM_CELL_NAME(N)  N##8
+#include "interpreter.inc"
+#undef BFVM_CELL_NAME
+#undef BFVM_CELL
 
-BFVirtualMachine *bfvmInitVirtualMachine(int argc, char **argv)
+#define BFVM_CELL          u16
+#define BFVM_CELL_NAME(N)  N##16
+#include "interpreter.inc"
+#undef BFVM_CELL_NAME
+#undef BFVM_CELL
+
+#define BFVM_CELL          u32
+#define BFVM_CELL_NAME(N)  N##32
+#include "interpreter.inc"
+#undef BFVM_CELL_NAME
+#undef BFVM_CELL
+
+void bfvmDefaultOptions(BFRunOptions *options)
+{
+    options->engine = BFVM_ENGINE_SWITCH;
+    options->fuel = 0;
+    options->tapeSize = BFVM_DEFAULT_TAPE_SIZE;
+    options->growable = BF_FALSE;
+    options->lineBuffered = BF_FALSE;
+    options->eof = BFVM_EOF_UNCHANGED;
+    options->read = NULL;
+    options->readContext = NULL;
+    options->write = NULL;
+    options->writeContext = NULL;
+}
+
+BFVirtualMachine *bfvmCreateVirtualMachine(BFProgram *program, const char *name, const BFRunOptions *options)
+{
+    BFVirtualMachine *const vm = bfvmCreateSharedVirtualMachine(program, name, options);
+    if (vm)
+    {
+        vm->owned = program;
+    }
+
+    return vm;
+}
+
+BFVirtualMachine *bfvmCreateSharedVirtualMachine(const BFProgram *program, const char *name, const BFRunOptions *options)
 {
-    if (argc < 2)
+    BFRunOptions defaults;
+    if (!options)
     {
-        bfvmPrintError("no sources");
+        bfvmDefaultOptions(&defaults);
+        options = &defaults;
+    }
+
+    if (!name)
+    {
+        name = BFVM_DEFAULT_NAME;
+    }
+
+    BFTape *const tape = bfvmTapeCreate(options->tapeSize, program->cellBits / 8, options->growable, program->reach);
+    BFVirtualMachine *const vm = tape ? BFVM_TRY_CALLOC(BFVirtualMachine, 1) : NULL;
+    if (!vm)
+    {
+        if (tape)
+        {
+            bfvmTapeFree(tape);
+        }
+
         return NULL;
     }
 
-    const BFOpCode *const code = bfcCompile(argv[1]);
-    if (!code)
+    vm->tape = tape;
+    vm->input = options->read ? bfvmInputCreateReader(options->read, options->readContext) : bfvmInputCreate(BFVM_STDIN_FD);
+    vm->output = options->write
+        ? bfvmOutputCreateWriter(options->write, options->writeContext, options->lineBuffered)
+        : bfvmOutputCreate(BFVM_STDOUT_FD, options->lineBuffered);
+    vm->program = program;
+    vm->code = program->code;
+    vm->run = bfvmSelectInterpreter(options->engine, program->cellBits);
+    vm->budget = options->fuel;
+    vm->fuel = (options->fuel > 0) ? options->fuel : BFVM_UNLIMITED_FUEL;
+    vm->eof = options->eof;
+    vm->prefixPending = BF_TRUE;
+    vm->profile = (options->engine == BFVM_ENGINE_PROFILED) ? bfvmProfileCreate(program) : NULL;
+    vm->name = BFVM_MALLOC(char, strlen(name) + 1);
+    strcpy(vm->name, name);
+
+#if !defined(BFVM_GUARD_PAGES)
+    vm->analysis = bfvmAnalyze(program);
+#endif
+
+    if (options->engine == BFVM_ENGINE_JIT)
+    {
+        const BFJitHooks hooks = { bfvmWriteCell, bfvmReadCell };
+        vm->jit = bfvmJitCompile(program, &hooks, options->fuel > 0);
+        if (vm->jit)
+        {
+            vm->run = bfvmRunJit;
+        }
+    }
+
+    return vm;
+}
+
+BFVirtualMachine *bfvmLoadVirtualMachine(const char *filepath, const BFCompileOptions *compileOptions, const BFRunOptions *options, BFCompileStatus *status)
+{
+    const u64 compileStart = bfcNow();
+    BFProgram *const program = bfvmLoadProgram(filepath, compileOptions, status);
+    if (!program)
+    {
+        return NULL;
+    }
+
+    BFVirtualMachine *const vm = bfvmCreateVirtualMachine(program, filepath, options);
+    if (!vm)
+    {
+        return bfvmCreateFailed(program, filepath, status);
+    }
+
+    vm->compileTime = bfcNow() - compileStart;
+    return vm;
+}
+
+BFVirtualMachine *bfvmCompileVirtualMachine(const char *name, const char *source, size_t size, const BFCompileOptions *compileOptions, const BFRunOptions *options, BFCompileStatus *status)
+{
+    const u64 compileStart = bfcNow();
+    BFProgram *const program = bfcCompileSource(name, source, size, compileOptions, status);
+    if (!program)
     {
         return NULL;
     }
 
-    BFVirtualMachine *const vm = BFVM_CALLOC(BFVirtualMachine, 1);
-    vm->code = code;
+    BFVirtualMachine *const vm = bfvmCreateVirtualMachine(program, name, options);
+    if (!vm)
+    {
+        return bfvmCreateFailed(program, name, status);
+    }
 
+    vm->compileTime = bfcNow() - compileStart;
     return vm;
 }
 
+/* bytecode images carry their own compile options, so options only apply to sources */
+BFProgram *bfvmLoadProgram(const char *filepath, const BFCompileOptions *options, BFCompileStatus *status)
+{
+    const size_t length = strlen(filepath);
+    const size_t extension = strlen(BFC_BYTECODE_EXTENSION);
+    if (length > extension && strcmp(filepath + length - extension, BFC_BYTECODE_EXTENSION) == 0)
+    {
+        return bfcLoadProgram(filepath, status);
+    }
+
+    return bfcCompile(filepath, options, status);
+}
+
 void bfvmCloseVirtualMachine(BFVirtualMachine *vm)
 {
-    BFVM_FREE((void *)vm->code);
+    bfvmSnapshotWait(&vm->snapshotWriter);
+
+    if (vm->jit)
+    {
+        bfvmJitFree(vm->jit);
+    }
+
+    if (vm->profile)
+    {
+        bfvmProfileFree(vm->profile);
+    }
+
+    if (vm->analysis)
+    {
+        bfvmAnalysisFree(vm->analysis);
+    }
+
+    if (vm->owned)
+    {
+        bfcFreeProgram(vm->owned);
+    }
+
+    BFVM_FREE(vm->threaded);
+    BFVM_FREE(vm->name);
+    bfvmInputFree(vm->input);
+    bfvmOutputFree(vm->output);
+    bfvmTapeFree(vm->tape);
     BFVM_FREE(vm);
 }
 
-void bfvmRunVirtualMachine(BFVirtualMachine *vm)
+/*
+ * Readies vm for another run of its program: the tape is cleared, the
+ * counters start over and the input and output drop whatever they buffered.
+ * Reading and writing continue through the same callbacks, which the caller
+ * can meanwhile point at the next input and output.
+ */
+void bfvmResetVirtualMachine(BFVirtualMachine *vm)
 {
-    while (vm->code[vm->ip].instr != BFC_END)
+    bfvmTapeClear(vm->tape);
+    bfvmInputReset(vm->input);
+    bfvmOutputReset(vm->output);
+
+    if (vm->profile)
     {
-        switch (vm->code[vm->ip].instr)
-        {
-            case BFC_ADDB:
-                bfvmAddb(vm, vm->code[vm->ip].operands.byteOffset);
-                break;
-            case BFC_SUBB:
-                bfvmSubb(vm, vm->code[vm->ip].operands.byteOffset);
-                break;
-            case BFC_ADDP:
-                bfvmAddp(vm, vm->code[vm->ip].operands.dataOffset);
-                break;
-            case BFC_SUBP:
-                bfvmSubp(vm, vm->code[vm->ip].operands.dataOffset);
-                break;
-            case BFC_WRITE:
-                bfvmWrite(vm);
-                break;
-            case BFC_READ:
-                bfvmRead(vm);
-                break;
-            case BFC_JZ:
-                bfvmJz(vm, vm->code[vm->ip].operands.instrLine);
-                break;
-            case BFC_JMP:
-                bfvmJmp(vm, vm->code[vm->ip].operands.instrLine);
-                break;
-            default:
-                bfvmPrintError("unknown instruction %d\n", vm->code[vm->ip].instr);
-                break;
-        }
+        bfvmProfileReset(vm->profile);
     }
+
+    vm->ip = 0;
+    vm->dp = 0;
+    vm->fuel = (vm->budget > 0) ? vm->budget : BFVM_UNLIMITED_FUEL;
+    vm->prefixPending = BF_TRUE;
+    vm->statsRequested = 0;
 }
 
-static void bfvmAddb(BFVirtualMachine *vm, u8 val)
+/*
+ * Runs the program to its end. Whatever it printed before failing still
+ * reaches the output, unless writing the output is what failed.
+ */
+BFRunStatus bfvmRunVirtualMachine(BFVirtualMachine *vm)
 {
-    vm->data[vm->dp] += val;
-    vm->ip++;
+    if (BFVM_TAPE_FAULTED(vm->tape))
+    {
+        bfvmTapeDisarm(vm->tape);
+        bfvmOutputFlush(vm->output);
+        return BFVM_RUN_OUT_OF_RANGE;
+    }
+
+    if (setjmp(vm->abort) != 0)
+    {
+        bfvmTapeDisarm(vm->tape);
+        return vm->status;
+    }
+
+    bfvmTapeArm(vm->tape);
+
+    vm->runStart = bfcNow();
+    if (vm->prefixPending)
+    {
+        bfvmStartFromPrefix(vm);
+    }
+
+    vm->run(vm);
+    bfvmTapeDisarm(vm->tape);
+
+    return bfvmOutputFlush(vm->output) ? BFVM_RUN_OK : BFVM_RUN_WRITE_ERROR;
 }
 
-static void bfvmSubb(BFVirtualMachine *vm, u8 val)
+void bfvmRefuel(BFVirtualMachine *vm, u64 fuel)
 {
-    vm->data[vm->dp] -= val;
-    vm->ip++;
+    if (vm->budget > 0)
+    {
+        vm->fuel = fuel;
+    }
 }
 
-static void bfvmAddp(BFVirtualMachine *vm, u16 val)
+BFBool bfvmSaveSnapshot(BFVirtualMachine *vm, const char *filepath, BFBool background)
 {
-    vm->dp += val;
-    if (vm->dp >= BFVM_DATA_SIZE)
+    const BFBool waited = bfvmSnapshotWait(&vm->snapshotWriter);
+    if (!bfvmOutputFlush(vm->output))
     {
-        bfvmPrintError("data pointer out of range");
+        return BF_FALSE;
     }
-    
-    vm->ip++;
+
+    BFSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BFVM_SNAPSHOT_MAGIC;
+    header.version = BFVM_SNAPSHOT_VERSION;
+    header.byteOrder = BFVM_SNAPSHOT_BYTE_ORDER;
+    header.cellBits = vm->program->cellBits;
+    header.program = bfvmSnapshotKey(vm->program);
+    header.ip = vm->ip;
+    header.dp = vm->dp;
+    header.tapeSize = vm->tape->size;
+    header.input = bfvmInputConsumed(vm->input);
+    header.output = bfvmOutputWritten(vm->output);
+
+    const BFBool saved = bfvmSnapshotSave(&header, vm->tape, filepath, background ? &vm->snapshotWriter : NULL);
+    return waited && saved;
 }
 
-static void bfvmSubp(BFVirtualMachine *vm, u16 val)
+BFBool bfvmWaitSnapshot(BFVirtualMachine *vm)
 {
-    vm->dp -= val;
-    if (vm->dp >= BFVM_DATA_SIZE)
+    return bfvmSnapshotWait(&vm->snapshotWriter);
+}
+
+/*
+ * A run resumes at any instruction, but the guard pages only catch accesses
+ * near the cells last accessed, so the data pointer has to be on the tape
+ * unless the program has already ended. Runs stop at loop edges, right after
+ * reading the current cell, so it always is in a snapshot that was saved
+ * rather than made up.
+ */
+BFSnapshotStatus bfvmRestoreSnapshot(BFVirtualMachine *vm, const char *filepath)
+{
+    BFSnapshotHeader header;
+    BFSnapshotStatus status = BFVM_SNAPSHOT_OK;
+    FILE *const file = bfvmSnapshotOpen(filepath, &header, &status);
+    if (!file)
+    {
+        return status;
+    }
+
+    if (header.program != bfvmSnapshotKey(vm->program) || header.cellBits != vm->program->cellBits)
+    {
+        status = BFVM_SNAPSHOT_OTHER_PROGRAM;
+    }
+    else if (header.tapeSize == 0 || header.tapeSize > SIZE_MAX || !bfvmTapeEnsure(vm->tape, (size_t)header.tapeSize - 1))
+    {
+        status = BFVM_SNAPSHOT_TAPE_TOO_SMALL;
+    }
+    else if (!bfvmIsInstruction(vm->program, header.ip)
+             || (header.ip < vm->program->size && header.dp >= header.tapeSize)
+             || !bfvmSnapshotLoadTape(file, &header, vm->tape))
+    {
+        status = BFVM_SNAPSHOT_INVALID;
+    }
+    else if (bfvmInputSkip(vm->input, header.input) != BFVM_INPUT_OK)
+    {
+        status = BFVM_SNAPSHOT_INPUT_TOO_SHORT;
+    }
+
+    fclose(file);
+    if (status != BFVM_SNAPSHOT_OK)
+    {
+        return status;
+    }
+
+    bfvmOutputResume(vm->output, header.output);
+
+    vm->ip = (size_t)header.ip;
+    vm->dp = (size_t)header.dp;
+    vm->prefixPending = BF_FALSE;
+    return BFVM_SNAPSHOT_OK;
+}
+
+const char *bfvmSnapshotStatusMessage(BFSnapshotStatus status)
+{
+    switch (status)
+    {
+        case BFVM_SNAPSHOT_UNREADABLE:
+            return "could not read snapshot";
+        case BFVM_SNAPSHOT_INVALID:
+            return "not a valid snapshot";
+        case BFVM_SNAPSHOT_OTHER_PROGRAM:
+            return "snapshot was taken of a different program or compile options";
+        case BFVM_SNAPSHOT_TAPE_TOO_SMALL:
+            return "snapshot does not fit on the tape";
+        case BFVM_SNAPSHOT_INPUT_TOO_SHORT:
+            return "input ended before where the snapshot was taken";
+        default:
+            return "success";
+    }
+}
+
+const char *bfvmRunStatusMessage(BFRunStatus status)
+{
+    switch (status)
+    {
+        case BFVM_RUN_OUT_OF_RANGE:
+            return "data pointer out of range";
+        case BFVM_RUN_READ_ERROR:
+            return "failed to read input";
+        case BFVM_RUN_WRITE_ERROR:
+            return "failed to write output";
+        case BFVM_RUN_OUT_OF_FUEL:
+            return "out of fuel";
+        case BFVM_RUN_OUT_OF_MEMORY:
+            return "out of memory";
+        default:
+            return "success";
+    }
+}
+
+const BFProgram *bfvmGetProgram(const BFVirtualMachine *vm)
+{
+    return vm->program;
+}
+
+u64 bfvmDispatched(const BFVirtualMachine *vm)
+{
+    return vm->profile ? bfvmProfileTotal(vm->profile) : 0;
+}
+
+/*
+ * Prints the runtime statistics gathered so far to stderr. Called once the
+ * program ends and, when requested, from the middle of the run.
+ */
+void bfvmPrintStats(BFVirtualMachine *vm)
+{
+    vm->statsRequested = 0;
+
+    const BFProfile *const profile = vm->profile;
+    if (!profile)
+    {
+        return;
+    }
+
+    const double compileTime = (double)vm->compileTime / 1e9;
+    const double runTime = (double)(bfcNow() - vm->runStart) / 1e9;
+
+    bfvmPrintInfo("stats of %s", vm->name);
+    fprintf(stderr, "\n  %-16s %20llu\n", "instructions", (unsigned long long)bfvmProfileTotal(profile));
+    fprintf(stderr, "  %-16s %20llu\n", "bytes read", (unsigned long long)bfvmInputConsumed(vm->input));
+    fprintf(stderr, "  %-16s %20llu\n", "bytes written", (unsigned long long)bfvmOutputWritten(vm->output));
+    fprintf(stderr, "  %-16s %20zu\n", "lowest cell", profile->minPointer);
+    fprintf(stderr, "  %-16s %20zu\n", "highest cell", profile->maxPointer);
+    fprintf(stderr, "  %-16s %18.3f s\n", "compile time", compileTime);
+    fprintf(stderr, "  %-16s %18.3f s\n", "run time", runTime);
+
+    bfvmProfilePrintMix(profile, vm->program);
+    fprintf(stderr, "\n");
+}
+
+void bfvmRequestStats(BFVirtualMachine *vm)
+{
+    vm->statsRequested = 1;
+}
+
+/* prints the profile report to stderr and writes the folded stacks to foldedPath */
+BFBool bfvmReportProfile(const BFVirtualMachine *vm, const char *foldedPath)
+{
+    if (!vm->profile)
+    {
+        return BF_FALSE;
+    }
+
+    bfvmProfileReport(vm->profile, vm->program, vm->name);
+    return bfvmProfileWriteFolded(vm->profile, vm->program, vm->name, foldedPath);
+}
+
+/* reported the way the compiler reports running out of memory */
+static BFVirtualMachine *bfvmCreateFailed(BFProgram *program, const char *name, BFCompileStatus *status)
+{
+    bfvmPrintError("out of memory while creating the tape of %s", name);
+    bfcFreeProgram(program);
+    if (status)
+    {
+        *status = BFC_COMPILE_OUT_OF_MEMORY;
+    }
+
+    return NULL;
+}
+
+static void bfvmRunJit(BFVirtualMachine *vm)
+{
+    BFJitState state = { vm->ip, vm->dp, vm->fuel };
+    const BFJitStatus status = bfvmJitExecute(vm->jit, vm->tape->cells, vm, &state);
+    vm->fuel = state.fuel;
+    if (status == BFJIT_OUT_OF_FUEL)
+    {
+        vm->ip = state.ip;
+        vm->dp = state.dp;
+        bfvmOutOfFuel(vm);
+    }
+
+    vm->ip = vm->program->size;
+}
+
+/*
+ * Starts a fresh run where the program's prefix stopped, unless this run
+ * would not have got there: its tape is too short for the prefix or its fuel
+ * runs out within it. The profiling engine always runs the whole program, so
+ * its counts cover every instruction.
+ */
+static void bfvmStartFromPrefix(BFVirtualMachine *vm)
+{
+    const BFProgram *const program = vm->program;
+    vm->prefixPending = BF_FALSE;
+
+    if (program->prefixIp == 0 || vm->profile || vm->fuel < program->prefixEdges ||
+        !bfvmTapeEnsure(vm->tape, program->prefixSpan - 1))
+    {
+        return;
+    }
+
+    if (program->prefixCells > 0)
+    {
+        memcpy(vm->tape->cells, program->prefixTape, program->prefixCells * vm->tape->cellSize);
+    }
+
+    if (!bfvmOutputWrite(vm->output, program->prefixOutput, program->prefixOutputSize))
     {
-        bfvmPrintError("data pointer out of range");
+        bfvmAbort(vm, BFVM_RUN_WRITE_ERROR);
     }
 
-    vm->ip++;
+    vm->ip = program->prefixIp;
+    vm->dp = program->prefixDp;
+    vm->fuel -= program->prefixEdges;
+}
+
+/* cell offsets do not move the pointer, so only pointer moves and scans are tracked */
+static void bfvmTrackPointer(BFVirtualMachine *vm)
+{
+    BFProfile *const profile = vm->profile;
+    if (vm->dp < profile->minPointer)
+    {
+        profile->minPointer = vm->dp;
+    }
+    else if (vm->dp > profile->maxPointer)
+    {
+        profile->maxPointer = vm->dp;
+    }
 }
 
-static void bfvmWrite(BFVirtualMachine *vm)
+/* whether ip is where an instruction starts, the END after the last one included */
+static BFBool bfvmIsInstruction(const BFProgram *program, u64 ip)
 {
-    if (putchar(vm->data[vm->dp]) == EOF)
+    size_t at = 0;
+    while (at < ip && at < program->size)
     {
-        bfvmPrintError("failed to output byte");
+        at += BFC_WIDTH(program->code[at]);
     }
 
-    vm->ip++;
+    return (at == ip) ? BF_TRUE : BF_FALSE;
+}
+
+/* the JIT only handles 8-bit cells and replaces this choice when it succeeds */
+static BFRunFn bfvmSelectInterpreter(BFEngine engine, u8 cellBits)
+{
+    const BFBool threaded = engine == BFVM_ENGINE_THREADED;
+    const BFBool profiled = engine == BFVM_ENGINE_PROFILED;
+    switch (cellBits)
+    {
+        case 16:
+            return threaded ? bfvmRunThreaded16 : profiled ? bfvmRunProfiled16 : bfvmRunSwitch16;
+        case 32:
+            return threaded ? bfvmRunThreaded32 : profiled ? bfvmRunProfiled32 : bfvmRunSwitch32;
+        default:
+            return threaded ? bfvmRunThreaded8 : profiled ? bfvmRunProfiled8 : bfvmRunSwitch8;
+    }
 }
 
-static void bfvmRead(BFVirtualMachine *vm)
+/*
+ * Ends the run with status. A failed write leaves the output as it is, any
+ * other failure flushes what the program printed before it went astray.
+ */
+static void bfvmAbort(BFVirtualMachine *vm, BFRunStatus status)
 {
-    i32 ch = 0x00;
-    if ((ch = fgetc(stdin)) == EOF)
+    if (status != BFVM_RUN_WRITE_ERROR)
     {
-        bfvmPrintError("failed to read byte");
+        bfvmOutputFlush(vm->output);
     }
 
-    vm->data[vm->dp] = (u8)ch;
-    vm->ip++;
+    vm->status = status;
+    longjmp(vm->abort, 1);
 }
 
-static void bfvmJz(BFVirtualMachine *vm, size_t line)
+#if !defined(BFVM_GUARD_PAGES)
+/* with guard pages the fault handler reports a stray access instead */
+static void bfvmOutOfRange(BFVirtualMachine *vm)
 {
-    vm->ip = (vm->data[vm->dp] != 0) ? vm->ip + 1 : line;
+    bfvmAbort(vm, BFVM_RUN_OUT_OF_RANGE);
 }
+#endif
 
-static void bfvmJmp(BFVirtualMachine *vm, size_t line)
+/* ip and dp have to be where the program resumes */
+static void bfvmOutOfFuel(BFVirtualMachine *vm)
 {
-    vm->ip = line;
+    bfvmAbort(vm, BFVM_RUN_OUT_OF_FUEL);
 }
 
+/* the data pointer is only checked when a cell is accessed through it */
+static void bfvmAddp(BFVirtualMachine *vm, u32 val)
+{
+    vm->dp += val;
+}
+
+static void bfvmSubp(BFVirtualMachine *vm, u32 val)
+{
+    vm->dp -= val;
+}
+
+/* single bytes that fit the buffer skip the call into the output module */
+static void bfvmPutByte(BFVirtualMachine *vm, u8 byte, size_t count)
+{
+    BFOutput *const output = vm->output;
+    if (count == 1 && output->pos < BFVM_OUTPUT_BUFFER_SIZE && (byte != '\n' || !output->lineBuffered))
+    {
+        output->buffer[output->pos++] = byte;
+        return;
+    }
+
+    if (!bfvmOutputPut(output, byte, count))
+    {
+        bfvmAbort(vm, BFVM_RUN_WRITE_ERROR);
+    }
+}
+
+/*
+ * Returns BF_FALSE once the input is exhausted. Output is only flushed when
+ * the program may actually have to wait for its input.
+ */
+static BFBool bfvmGetByte(BFVirtualMachine *vm, u8 *byte)
+{
+    BFInput *const input = vm->input;
+    if (input->pos < input->end)
+    {
+        *byte = input->data[input->pos++];
+        return BF_TRUE;
+    }
+
+    if (!bfvmInputBuffered(input) && !bfvmOutputFlush(vm->output))
+    {
+        bfvmAbort(vm, BFVM_RUN_WRITE_ERROR);
+    }
+
+    const BFInputStatus status = bfvmInputGet(input, byte);
+    if (status == BFVM_INPUT_ERROR)
+    {
+        bfvmAbort(vm, BFVM_RUN_READ_ERROR);
+    }
+
+    return status == BFVM_INPUT_OK;
+}
+
+static void bfvmWriteCell(void *context, u8 *cell, u32 count)
+{
+    bfvmPutByte((BFVirtualMachine *)context, *cell, count);
+}
+
+static void bfvmReadCell(void *context, u8 *cell, u32 count)
+{
+    (void)count;
+
+    bfvmInput8((BFVirtualMachine *)context, cell);
+}
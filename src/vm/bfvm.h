@@ -1,11 +1,137 @@
 #ifndef BFVM_H
 #define BFVM_H
 
+#include "input.h"
+#include "output.h"
+
+#include "core/types.h"
+
+#include <bfc/bfc.h>
+
 typedef struct BFVirtualMachine BFVirtualMachine;
 
-BFVirtualMachine *bfvmInitVirtualMachine(int argc, char **argv);
+/*
+ * The profiling engine is the switch loop counting every instruction it
+ * dispatches; bfvmDispatched, bfvmPrintStats and bfvmReportProfile need it.
+ * The JIT falls back to the switch loop where it is unsupported.
+ */
+typedef enum BFEngine
+{
+    BFVM_ENGINE_SWITCH,
+    BFVM_ENGINE_THREADED,
+    BFVM_ENGINE_JIT,
+    BFVM_ENGINE_PROFILED
+} BFEngine;
+
+/*
+ * How a virtual machine runs its program. A NULL read or write callback
+ * stands for the standard input or output of the process; the callbacks get
+ * readContext and writeContext as their first argument. fuel is how many
+ * loop back-edges a run may take before it stops with BFVM_RUN_OUT_OF_FUEL,
+ * 0 for no limit. bfvmDefaultOptions fills in what the command line uses
+ * when no option is given.
+ */
+typedef struct BFRunOptions
+{
+    BFEngine   engine;
+    u64        fuel;
+    size_t     tapeSize;
+    BFBool     growable;
+    BFBool     lineBuffered;
+    BFEofMode  eof;
+    BFReadFn   read;
+    void      *readContext;
+    BFWriteFn  write;
+    void      *writeContext;
+} BFRunOptions;
+
+typedef enum BFRunStatus
+{
+    BFVM_RUN_OK,
+    BFVM_RUN_OUT_OF_RANGE,
+    BFVM_RUN_READ_ERROR,
+    BFVM_RUN_WRITE_ERROR,
+    BFVM_RUN_OUT_OF_FUEL,
+    BFVM_RUN_OUT_OF_MEMORY
+} BFRunStatus;
+
+typedef enum BFSnapshotStatus
+{
+    BFVM_SNAPSHOT_OK,
+    BFVM_SNAPSHOT_UNREADABLE,
+    BFVM_SNAPSHOT_INVALID,
+    BFVM_SNAPSHOT_OTHER_PROGRAM,
+    BFVM_SNAPSHOT_TAPE_TOO_SMALL,
+    BFVM_SNAPSHOT_INPUT_TOO_SHORT
+} BFSnapshotStatus;
+
+void bfvmDefaultOptions(BFRunOptions *options);
+
+/*
+ * A virtual machine owns the program it runs, unless it was created with
+ * bfvmCreateSharedVirtualMachine; a shared program has to outlive every
+ * virtual machine running it. Virtual machines share no other state, so any
+ * number of them can exist at a time, each used by one thread at a time.
+ * name only appears in reports and may be NULL. Creating one returns NULL
+ * if there is no memory for its tape, which options->tapeSize can ask for a
+ * lot of; the process is never ended over it.
+ *
+ * bfvmLoadVirtualMachine compiles a source file, or maps it if it is a
+ * bytecode image, and bfvmCompileVirtualMachine compiles source held in
+ * memory. Both return NULL and set status if that fails, or if the virtual
+ * machine cannot be created, which sets BFC_COMPILE_OUT_OF_MEMORY.
+ */
+BFVirtualMachine *bfvmCreateVirtualMachine(BFProgram *program, const char *name, const BFRunOptions *options);
+BFVirtualMachine *bfvmCreateSharedVirtualMachine(const BFProgram *program, const char *name, const BFRunOptions *options);
+BFVirtualMachine *bfvmLoadVirtualMachine(const char *filepath, const BFCompileOptions *compileOptions, const BFRunOptions *options, BFCompileStatus *status);
+BFVirtualMachine *bfvmCompileVirtualMachine(const char *name, const char *source, size_t size, const BFCompileOptions *compileOptions, const BFRunOptions *options, BFCompileStatus *status);
 void bfvmCloseVirtualMachine(BFVirtualMachine *vm);
 
-void bfvmRunVirtualMachine(BFVirtualMachine *vm);
+/* compiles a source file or maps a bytecode image, as bfvmLoadVirtualMachine does */
+BFProgram *bfvmLoadProgram(const char *filepath, const BFCompileOptions *options, BFCompileStatus *status);
+
+/*
+ * A run that stops with BFVM_RUN_OUT_OF_FUEL keeps all of its state and
+ * picks up where it stopped when run again, once bfvmRefuel gave it more.
+ * Fuel only limits virtual machines created with some.
+ */
+void bfvmResetVirtualMachine(BFVirtualMachine *vm);
+BFRunStatus bfvmRunVirtualMachine(BFVirtualMachine *vm);
+void bfvmRefuel(BFVirtualMachine *vm, u64 fuel);
+const char *bfvmRunStatusMessage(BFRunStatus status);
+
+/*
+ * A snapshot holds what a stopped run needs to go on later, possibly in
+ * another process: the tape, ip and dp, and how much input the program read
+ * and output it wrote. It can be taken between runs, typically of one that
+ * ran out of fuel, and only fits the program it was taken of.
+ *
+ * bfvmSaveSnapshot flushes the output first. In the background, the file is
+ * written by a forked copy of the process where there is one, so the caller
+ * can run on at once; bfvmWaitSnapshot waits for that copy and returns
+ * whether it wrote the file. Saving again or closing the virtual machine
+ * waits for it as well, and saving fails if it did.
+ *
+ * bfvmRestoreSnapshot loads a snapshot into a virtual machine that has not
+ * run yet and skips the input the program had read. The output is left
+ * alone, so whatever the program wrote after the snapshot was taken is
+ * written again.
+ */
+BFBool bfvmSaveSnapshot(BFVirtualMachine *vm, const char *filepath, BFBool background);
+BFBool bfvmWaitSnapshot(BFVirtualMachine *vm);
+BFSnapshotStatus bfvmRestoreSnapshot(BFVirtualMachine *vm, const char *filepath);
+const char *bfvmSnapshotStatusMessage(BFSnapshotStatus status);
+
+const BFProgram *bfvmGetProgram(const BFVirtualMachine *vm);
+
+/*
+ * Statistics of the profiling engine. bfvmRequestStats is safe to call from a
+ * signal handler; the running program prints its statistics at the next loop
+ * edge.
+ */
+u64 bfvmDispatched(const BFVirtualMachine *vm);
+void bfvmPrintStats(BFVirtualMachine *vm);
+void bfvmRequestStats(BFVirtualMachine *vm);
+BFBool bfvmReportProfile(const BFVirtualMachine *vm, const char *foldedPath);
 
 #endif /* BFVM_H */
@@ -0,0 +1,232 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "input.h"
+
+#include "core/memory.h"
+#include "core/platform.h"
+
+#include <errno.h>
+
+#if defined(BFVM_WINDOWS)
+#   include <io.h>
+#   define BFVM_READ(FD, BUF, N) _read(FD, BUF, (unsigned int)(N))
+#else
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   define BFVM_READ(FD, BUF, N) read(FD, BUF, N)
+#endif
+
+static void bfvmInputMap(BFInput *input);
+static BFInputStatus bfvmInputFill(BFInput *input);
+static long bfvmInputReadFd(void *context, u8 *buffer, size_t size);
+
+BFInput *bfvmInputCreate(int fd)
+{
+    BFInput *const input = bfvmInputCreateReader(bfvmInputReadFd, NULL);
+    input->context = &input->fd;
+    input->fd = fd;
+
+    bfvmInputMap(input);
+    return input;
+}
+
+BFInput *bfvmInputCreateReader(BFReadFn read, void *context)
+{
+    BFInput *const input = BFVM_MALLOC(BFInput, 1);
+    input->data = NULL;
+    input->pos = 0;
+    input->end = 0;
+    input->begin = 0;
+    input->consumed = 0;
+    input->buffer = NULL;
+    input->mapping = NULL;
+    input->mappingSize = 0;
+    input->read = read;
+    input->context = context;
+    input->fd = -1;
+    input->eof = BF_FALSE;
+
+    return input;
+}
+
+void bfvmInputFree(BFInput *input)
+{
+#if !defined(BFVM_WINDOWS)
+    if (input->mapping)
+    {
+        munmap(input->mapping, input->mappingSize);
+    }
+#endif
+
+    BFVM_FREE(input->buffer);
+    BFVM_FREE(input);
+}
+
+/*
+ * Drops whatever was read ahead and starts counting anew; the next byte comes
+ * from read. A mapping is released, and the descriptor already points past it.
+ */
+void bfvmInputReset(BFInput *input)
+{
+#if !defined(BFVM_WINDOWS)
+    if (input->mapping)
+    {
+        munmap(input->mapping, input->mappingSize);
+    }
+#endif
+
+    input->data = NULL;
+    input->pos = 0;
+    input->end = 0;
+    input->begin = 0;
+    input->consumed = 0;
+    input->mapping = NULL;
+    input->mappingSize = 0;
+    input->eof = BF_FALSE;
+}
+
+BFInputStatus bfvmInputGet(BFInput *input, u8 *byte)
+{
+    if (input->pos == input->end)
+    {
+        const BFInputStatus status = bfvmInputFill(input);
+        if (status != BFVM_INPUT_OK)
+        {
+            return status;
+        }
+    }
+
+    *byte = input->data[input->pos++];
+    return BFVM_INPUT_OK;
+}
+
+/* hands out count bytes to nobody, as if the program had read them */
+BFInputStatus bfvmInputSkip(BFInput *input, u64 count)
+{
+    while (count > 0)
+    {
+        if (input->pos == input->end)
+        {
+            const BFInputStatus status = bfvmInputFill(input);
+            if (status != BFVM_INPUT_OK)
+            {
+                return status;
+            }
+        }
+
+        const size_t available = input->end - input->pos;
+        const size_t step = (count < available) ? (size_t)count : available;
+        input->pos += step;
+        count -= step;
+    }
+
+    return BFVM_INPUT_OK;
+}
+
+/* whether the next bfvmInputGet returns without waiting on the descriptor */
+BFBool bfvmInputBuffered(const BFInput *input)
+{
+    return (input->pos < input->end || input->eof) ? BF_TRUE : BF_FALSE;
+}
+
+/* how many bytes the program has read so far */
+u64 bfvmInputConsumed(const BFInput *input)
+{
+    return input->consumed + (input->pos - input->begin);
+}
+
+/*
+ * Maps the rest of a regular file and moves the descriptor past it, so that
+ * the buffered reads taking over afterwards continue where the mapping ends.
+ */
+static void bfvmInputMap(BFInput *input)
+{
+#if defined(BFVM_WINDOWS)
+    (void)input;
+#else
+    struct stat info;
+    if (fstat(input->fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+    {
+        return;
+    }
+
+    const off_t offset = lseek(input->fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= info.st_size)
+    {
+        return;
+    }
+
+    const size_t size = (size_t)info.st_size;
+    void *const mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return;
+    }
+
+    if (lseek(input->fd, info.st_size, SEEK_SET) < 0)
+    {
+        munmap(mapping, size);
+        return;
+    }
+
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    input->data = (const u8 *)mapping;
+    input->pos = (size_t)offset;
+    input->end = size;
+    input->begin = (size_t)offset;
+    input->mapping = mapping;
+    input->mappingSize = size;
+#endif
+}
+
+static BFInputStatus bfvmInputFill(BFInput *input)
+{
+    if (input->eof)
+    {
+        return BFVM_INPUT_EOF;
+    }
+
+    if (!input->buffer)
+    {
+        input->buffer = BFVM_MALLOC(u8, BFVM_INPUT_BUFFER_SIZE);
+    }
+
+    const long count = input->read(input->context, input->buffer, BFVM_INPUT_BUFFER_SIZE);
+    if (count < 0)
+    {
+        return BFVM_INPUT_ERROR;
+    }
+
+    if (count == 0)
+    {
+        input->eof = BF_TRUE;
+        return BFVM_INPUT_EOF;
+    }
+
+    input->consumed += input->pos - input->begin;
+    input->data = input->buffer;
+    input->pos = 0;
+    input->end = (size_t)count;
+    input->begin = 0;
+    return BFVM_INPUT_OK;
+}
+
+/* interrupted reads are retried, so only real errors reach the program */
+static long bfvmInputReadFd(void *context, u8 *buffer, size_t size)
+{
+    const int fd = *(const int *)context;
+    for (;;)
+    {
+        const long count = (long)BFVM_READ(fd, buffer, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        return (count < 0) ? -1 : count;
+    }
+}
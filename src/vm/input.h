@@ -0,0 +1,65 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "core/types.h"
+
+#define BFVM_INPUT_BUFFER_SIZE 65536UL
+#define BFVM_STDIN_FD          0
+
+/* what ',' stores once the input is exhausted */
+typedef enum BFEofMode
+{
+    BFVM_EOF_UNCHANGED,
+    BFVM_EOF_ZERO,
+    BFVM_EOF_MINUS_ONE
+} BFEofMode;
+
+typedef enum BFInputStatus
+{
+    BFVM_INPUT_OK,
+    BFVM_INPUT_EOF,
+    BFVM_INPUT_ERROR
+} BFInputStatus;
+
+/*
+ * Reads up to size bytes into buffer and returns how many it read, 0 at the
+ * end of the input or -1 on an error.
+ */
+typedef long (*BFReadFn)(void *context, u8 *buffer, size_t size);
+
+/*
+ * Program input read ahead of the program in large blocks through read. An
+ * input created on a regular file is mapped and handed out straight from the
+ * mapping instead; bytes appended to the file after it was mapped are picked
+ * up with ordinary reads once the mapping is used up.
+ *
+ * consumed counts the bytes handed out from earlier blocks; the current block
+ * started handing them out at begin.
+ */
+typedef struct BFInput
+{
+    const u8 *data;
+    size_t    pos;
+    size_t    end;
+    size_t    begin;
+    u64       consumed;
+    u8       *buffer;
+    void     *mapping;
+    size_t    mappingSize;
+    BFReadFn  read;
+    void     *context;
+    int       fd;
+    BFBool    eof;
+} BFInput;
+
+BFInput *bfvmInputCreate(int fd);
+BFInput *bfvmInputCreateReader(BFReadFn read, void *context);
+void bfvmInputFree(BFInput *input);
+void bfvmInputReset(BFInput *input);
+
+BFInputStatus bfvmInputGet(BFInput *input, u8 *byte);
+BFInputStatus bfvmInputSkip(BFInput *input, u64 count);
+BFBool bfvmInputBuffered(const BFInput *input);
+u64 bfvmInputConsumed(const BFInput *input);
+
+#endif /* INPUT_H */
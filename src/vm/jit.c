@@ -0,0 +1,476 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "jit.h"
+
+#include "core/error.h"
+#include "core/memory.h"
+
+#if defined(BFVM_JIT_SUPPORTED)
+
+#include <string.h>
+#include <sys/mman.h>
+
+#define INIT_BUFFER_SIZE 4096UL
+
+/*
+ * Register usage of the generated code (System V AMD64):
+ *
+ *   rbx - pointer to the current cell (&data[dp])
+ *   r12 - context handed back to the I/O hooks
+ *   r13 - base of the data tape, to turn rbx back into dp
+ *   r14 - fuel left, with fuel checks
+ *   r15 - the BFJitState of the run
+ *
+ * All five are callee-saved, so they survive calls into the I/O hooks. Cells
+ * at a non-zero offset are addressed through rcx/rdx. The generated code does
+ * no bounds checks: the JIT is only built where the tape has guard pages, so
+ * a stray access faults like it does in the interpreters.
+ */
+
+#define REG_RCX 0x01
+#define REG_RDX 0x02
+#define REG_RBX 0x03
+
+typedef BFJitStatus (*BFJitEntry)(u8 *cell, void *context, u8 *base, BFJitState *state, const u8 *start);
+
+/* offsets maps every instruction to its machine code, so a run can start anywhere */
+struct BFJitCode
+{
+    u8     *memory;
+    size_t  size;
+    size_t *offsets;
+};
+
+typedef struct BFJitEmitter
+{
+    u8     *buffer;
+    size_t  pos;
+    size_t  size;
+    size_t *offsets;
+    size_t *jumps;
+    size_t  fuelPatchCount;
+    size_t *fuelPatches;
+    size_t  fuelPatchSize;
+} BFJitEmitter;
+
+static void bfvmJitEmitByte(BFJitEmitter *emitter, u8 byte);
+static void bfvmJitEmitBytes(BFJitEmitter *emitter, const u8 *bytes, size_t count);
+static void bfvmJitEmitU32(BFJitEmitter *emitter, u32 value);
+static void bfvmJitEmitU64(BFJitEmitter *emitter, u64 value);
+static void bfvmJitEmitFuelCheck(BFJitEmitter *emitter, const BFOpCode *code, size_t ip);
+static u8 bfvmJitEmitCellAddress(BFJitEmitter *emitter, i32 offset, u8 reg);
+static void bfvmJitEmitCellOp(BFJitEmitter *emitter, u8 opcode, u8 ext, BFOpCode op);
+static void bfvmJitEmitScan(BFJitEmitter *emitter, i16 step);
+static void bfvmJitEmitMul(BFJitEmitter *emitter, const BFOpCode *code, size_t ip);
+static void bfvmJitEmitCall(BFJitEmitter *emitter, BFJitIOFn fn, u8 cell, u32 count);
+static void bfvmJitPatchRel32(BFJitEmitter *emitter, size_t at, size_t target);
+
+/*
+ * With fueled set, every loop back-edge taken costs one unit of fuel, and
+ * running out stops the run right before the jump. Without it the state's
+ * fuel is left alone and the run never stops early.
+ */
+BFJitCode *bfvmJitCompile(const BFProgram *program, const BFJitHooks *hooks, BFBool fueled)
+{
+    static const u8 prologue[] = {
+        0x53,                   /* push rbx             */
+        0x41, 0x54,             /* push r12             */
+        0x41, 0x55,             /* push r13             */
+        0x41, 0x56,             /* push r14             */
+        0x41, 0x57,             /* push r15             */
+        0x48, 0x89, 0xFB,       /* mov rbx, rdi         */
+        0x49, 0x89, 0xF4,       /* mov r12, rsi         */
+        0x49, 0x89, 0xD5,       /* mov r13, rdx         */
+        0x49, 0x89, 0xCF,       /* mov r15, rcx         */
+        0x4D, 0x8B, 0x77, 0x10, /* mov r14, [r15 + 16]  */
+        0x41, 0xFF, 0xE0        /* jmp r8               */
+    };
+    static const u8 epilogue[] = {
+        0x41, 0x5F,             /* pop r15              */
+        0x41, 0x5E,             /* pop r14              */
+        0x41, 0x5D,             /* pop r13              */
+        0x41, 0x5C,             /* pop r12              */
+        0x5B,                   /* pop rbx              */
+        0xC3                    /* ret                  */
+    };
+    static const u8 saveFuel[] = {
+        0x4D, 0x89, 0x77, 0x10  /* mov [r15 + 16], r14  */
+    };
+    static const u8 outOfFuel[] = {
+        0x49, 0x89, 0x0F,       /* mov [r15], rcx       */
+        0x48, 0x89, 0xD8,       /* mov rax, rbx         */
+        0x4C, 0x29, 0xE8,       /* sub rax, r13         */
+        0x49, 0x89, 0x47, 0x08, /* mov [r15 + 8], rax   */
+        0x49, 0xC7, 0x47, 0x10, /* mov qword [r15 + 16], 0 */
+        0x00, 0x00, 0x00, 0x00
+    };
+
+    /* the emitted code works on byte cells only */
+    if (program->cellBits != 8)
+    {
+        return NULL;
+    }
+
+    const BFOpCode *const code = program->code;
+    const size_t count = program->size;
+
+    BFJitEmitter emitter = { 0 };
+    emitter.buffer = BFVM_MALLOC(u8, INIT_BUFFER_SIZE);
+    emitter.size = INIT_BUFFER_SIZE;
+    emitter.offsets = BFVM_MALLOC(size_t, count + 1);
+    emitter.jumps = BFVM_MALLOC(size_t, count + 1);
+    emitter.fuelPatches = BFVM_MALLOC(size_t, INIT_BUFFER_SIZE);
+    emitter.fuelPatchSize = INIT_BUFFER_SIZE;
+
+    bfvmJitEmitBytes(&emitter, prologue, sizeof(prologue));
+
+    for (size_t i = 0; i < count; i += BFC_WIDTH(code[i]))
+    {
+        emitter.offsets[i] = emitter.pos;
+        switch (BFC_INSTR(code[i]))
+        {
+            case BFC_ADDB:
+                bfvmJitEmitCellOp(&emitter, 0x80, 0, code[i]); /* add byte [cell], imm8 */
+                break;
+            case BFC_SUBB:
+                bfvmJitEmitCellOp(&emitter, 0x80, 5, code[i]); /* sub byte [cell], imm8 */
+                break;
+            case BFC_ADDP:
+            {
+                const u8 bytes[] = { 0x48, 0x81, 0xC3 }; /* add rbx, imm32 */
+                bfvmJitEmitBytes(&emitter, bytes, sizeof(bytes));
+                bfvmJitEmitU32(&emitter, BFC_OPERAND(code[i]));
+            } break;
+            case BFC_SUBP:
+            {
+                const u8 bytes[] = { 0x48, 0x81, 0xEB }; /* sub rbx, imm32 */
+                bfvmJitEmitBytes(&emitter, bytes, sizeof(bytes));
+                bfvmJitEmitU32(&emitter, BFC_OPERAND(code[i]));
+            } break;
+            case BFC_WRITE:
+            {
+                const u8 cell = bfvmJitEmitCellAddress(&emitter, BFC_OFFSET(code[i]), REG_RCX);
+                bfvmJitEmitCall(&emitter, hooks->write, cell, BFC_VALUE(code[i]));
+            } break;
+            case BFC_READ:
+            {
+                const u8 cell = bfvmJitEmitCellAddress(&emitter, BFC_OFFSET(code[i]), REG_RCX);
+                bfvmJitEmitCall(&emitter, hooks->read, cell, 1);
+            } break;
+            case BFC_JZ:
+            {
+                const u8 bytes[] = {
+                    0x80, 0x3B, 0x00, /* cmp byte [rbx], 0 */
+                    0x0F, 0x84        /* je rel32          */
+                };
+                bfvmJitEmitBytes(&emitter, bytes, sizeof(bytes));
+                emitter.jumps[i] = emitter.pos;
+                bfvmJitEmitU32(&emitter, 0);
+            } break;
+            case BFC_JNZ:
+            {
+                if (fueled)
+                {
+                    bfvmJitEmitFuelCheck(&emitter, code, i);
+                    break;
+                }
+
+                const u8 bytes[] = {
+                    0x80, 0x3B, 0x00, /* cmp byte [rbx], 0 */
+                    0x0F, 0x85        /* jne rel32         */
+                };
+                bfvmJitEmitBytes(&emitter, bytes, sizeof(bytes));
+                emitter.jumps[i] = emitter.pos;
+                bfvmJitEmitU32(&emitter, 0);
+            } break;
+            case BFC_SET:
+                bfvmJitEmitCellOp(&emitter, 0xC6, 0, code[i]); /* mov byte [cell], imm8 */
+                break;
+            case BFC_SCAN:
+                bfvmJitEmitScan(&emitter, BFC_OFFSET(code[i]));
+                break;
+            case BFC_MUL:
+                bfvmJitEmitMul(&emitter, code, i);
+                break;
+            default:
+                bfvmPanic("unknown instruction %d", BFC_INSTR(code[i]));
+                break;
+        }
+    }
+
+    emitter.offsets[count] = emitter.pos;
+    if (fueled)
+    {
+        bfvmJitEmitBytes(&emitter, saveFuel, sizeof(saveFuel));
+    }
+
+    bfvmJitEmitBytes(&emitter, (const u8[]){ 0x31, 0xC0 }, 2); /* xor eax, eax */
+    bfvmJitEmitBytes(&emitter, epilogue, sizeof(epilogue));
+
+    /* every fuel check leaves the instruction to resume at in ecx */
+    const size_t fuelStub = emitter.pos;
+    if (fueled)
+    {
+        bfvmJitEmitBytes(&emitter, outOfFuel, sizeof(outOfFuel));
+        bfvmJitEmitByte(&emitter, 0xB8); /* mov eax, imm32 */
+        bfvmJitEmitU32(&emitter, BFJIT_OUT_OF_FUEL);
+        bfvmJitEmitBytes(&emitter, epilogue, sizeof(epilogue));
+    }
+
+    for (size_t i = 0; i < count; i += BFC_WIDTH(code[i]))
+    {
+        if (BFC_INSTR(code[i]) == BFC_JZ || BFC_INSTR(code[i]) == BFC_JNZ)
+        {
+            bfvmJitPatchRel32(&emitter, emitter.jumps[i], emitter.offsets[BFC_JUMP_TARGET(code, i)]);
+        }
+    }
+
+    for (size_t i = 0; i < emitter.fuelPatchCount; i++)
+    {
+        bfvmJitPatchRel32(&emitter, emitter.fuelPatches[i], fuelStub);
+    }
+
+    u8 *memory = (u8 *)mmap(NULL, emitter.pos, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        bfvmPrintInfo("failed to map %zu bytes of executable memory", emitter.pos);
+        BFVM_FREE(emitter.buffer);
+        BFVM_FREE(emitter.offsets);
+        BFVM_FREE(emitter.jumps);
+        BFVM_FREE(emitter.fuelPatches);
+        return NULL;
+    }
+
+    memcpy(memory, emitter.buffer, emitter.pos);
+    if (mprotect(memory, emitter.pos, PROT_READ | PROT_EXEC) != 0)
+    {
+        bfvmPrintInfo("failed to make JIT code executable");
+        munmap(memory, emitter.pos);
+        memory = NULL;
+    }
+
+    BFVM_FREE(emitter.buffer);
+    BFVM_FREE(emitter.jumps);
+    BFVM_FREE(emitter.fuelPatches);
+    if (!memory)
+    {
+        BFVM_FREE(emitter.offsets);
+        return NULL;
+    }
+
+    BFJitCode *const jit = BFVM_MALLOC(BFJitCode, 1);
+    jit->memory = memory;
+    jit->size = emitter.pos;
+    jit->offsets = emitter.offsets;
+
+    return jit;
+}
+
+void bfvmJitFree(BFJitCode *jit)
+{
+    munmap(jit->memory, jit->size);
+    BFVM_FREE(jit->offsets);
+    BFVM_FREE(jit);
+}
+
+BFJitStatus bfvmJitExecute(const BFJitCode *jit, u8 *data, void *context, BFJitState *state)
+{
+    BFJitEntry entry = NULL;
+    memcpy(&entry, &jit->memory, sizeof(entry));
+
+    return entry(data + state->dp, context, data, state, jit->memory + jit->offsets[state->ip]);
+}
+
+static void bfvmJitEmitByte(BFJitEmitter *emitter, u8 byte)
+{
+    if (emitter->pos >= emitter->size)
+    {
+        emitter->size = emitter->size + (emitter->size / 2);
+        emitter->buffer = BFVM_REALLOC(u8, emitter->buffer, emitter->size);
+    }
+
+    emitter->buffer[emitter->pos++] = byte;
+}
+
+static void bfvmJitEmitBytes(BFJitEmitter *emitter, const u8 *bytes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        bfvmJitEmitByte(emitter, bytes[i]);
+    }
+}
+
+static void bfvmJitEmitU32(BFJitEmitter *emitter, u32 value)
+{
+    for (size_t i = 0; i < sizeof(value); i++)
+    {
+        bfvmJitEmitByte(emitter, (u8)(value >> (8 * i)));
+    }
+}
+
+static void bfvmJitEmitU64(BFJitEmitter *emitter, u64 value)
+{
+    for (size_t i = 0; i < sizeof(value); i++)
+    {
+        bfvmJitEmitByte(emitter, (u8)(value >> (8 * i)));
+    }
+}
+
+/*
+ * Closes a loop, taking one unit of fuel for every jump back. Once the fuel
+ * is gone the stub takes over instead, with the start of the loop body to
+ * resume at in ecx.
+ */
+static void bfvmJitEmitFuelCheck(BFJitEmitter *emitter, const BFOpCode *code, size_t ip)
+{
+    static const u8 check[] = {
+        0x80, 0x3B, 0x00,       /* cmp byte [rbx], 0 */
+        0x74, 0x14,             /* je done           */
+        0x49, 0x83, 0xEE, 0x01, /* sub r14, 1        */
+        0x0F, 0x83              /* jae rel32         */
+    };
+
+    bfvmJitEmitBytes(emitter, check, sizeof(check));
+    emitter->jumps[ip] = emitter->pos;
+    bfvmJitEmitU32(emitter, 0);
+
+    bfvmJitEmitByte(emitter, 0xB9); /* mov ecx, imm32 */
+    bfvmJitEmitU32(emitter, (u32)BFC_JUMP_TARGET(code, ip));
+    bfvmJitEmitByte(emitter, 0xE9); /* jmp rel32 */
+
+    if (emitter->fuelPatchCount >= emitter->fuelPatchSize)
+    {
+        emitter->fuelPatchSize = emitter->fuelPatchSize + (emitter->fuelPatchSize / 2);
+        emitter->fuelPatches = BFVM_REALLOC(size_t, emitter->fuelPatches, emitter->fuelPatchSize);
+    }
+
+    emitter->fuelPatches[emitter->fuelPatchCount++] = emitter->pos;
+    bfvmJitEmitU32(emitter, 0);
+}
+
+static void bfvmJitEmitScan(BFJitEmitter *emitter, i16 step)
+{
+    static const u8 test[] = {
+        0x80, 0x3B, 0x00, /* cmp byte [rbx], 0 */
+        0x0F, 0x84        /* je rel32          */
+    };
+    static const u8 move[] = { 0x48, 0x81, 0xC3 }; /* add rbx, imm32 */
+
+    const size_t loop = emitter->pos;
+    bfvmJitEmitBytes(emitter, test, sizeof(test));
+    const size_t done = emitter->pos;
+    bfvmJitEmitU32(emitter, 0);
+
+    bfvmJitEmitBytes(emitter, move, sizeof(move));
+    bfvmJitEmitU32(emitter, (u32)(i32)step);
+
+    bfvmJitEmitByte(emitter, 0xE9); /* jmp rel32 */
+    bfvmJitEmitU32(emitter, 0);
+    bfvmJitPatchRel32(emitter, emitter->pos - sizeof(u32), loop);
+    bfvmJitPatchRel32(emitter, done, emitter->pos);
+}
+
+static void bfvmJitEmitMul(BFJitEmitter *emitter, const BFOpCode *code, size_t ip)
+{
+    static const u8 test[] = {
+        0x85, 0xC0, /* test eax, eax */
+        0x0F, 0x84  /* je rel32      */
+    };
+
+    const u8 source = bfvmJitEmitCellAddress(emitter, BFC_OFFSET(code[ip]), REG_RCX);
+    bfvmJitEmitBytes(emitter, (const u8[]){ 0x0F, 0xB6, source }, 3); /* movzx eax, byte [source] */
+    bfvmJitEmitBytes(emitter, test, sizeof(test));
+    const size_t skip = emitter->pos;
+    bfvmJitEmitU32(emitter, 0);
+
+    const u8 target = bfvmJitEmitCellAddress(emitter, BFC_MUL_TARGET(code, ip), REG_RDX);
+    bfvmJitEmitBytes(emitter, (const u8[]){ 0x69, 0xC0 }, 2); /* imul eax, eax, imm32 */
+    bfvmJitEmitU32(emitter, BFC_VALUE(code[ip]));
+    bfvmJitEmitBytes(emitter, (const u8[]){ 0x00, target }, 2); /* add byte [target], al */
+    bfvmJitPatchRel32(emitter, skip, emitter->pos);
+}
+
+/*
+ * Leaves the address of the cell at the given offset in a register and returns
+ * its ModRM encoding. Offset zero uses rbx directly.
+ */
+static u8 bfvmJitEmitCellAddress(BFJitEmitter *emitter, i32 offset, u8 reg)
+{
+    if (offset == 0)
+    {
+        return REG_RBX;
+    }
+
+    const u8 lea[] = { 0x48, 0x8D, (u8)(0x83 | (reg << 3)) }; /* lea reg, [rbx + disp32] */
+    bfvmJitEmitBytes(emitter, lea, sizeof(lea));
+    bfvmJitEmitU32(emitter, (u32)(i32)offset);
+
+    return reg;
+}
+
+static void bfvmJitEmitCellOp(BFJitEmitter *emitter, u8 opcode, u8 ext, BFOpCode op)
+{
+    const u8 cell = bfvmJitEmitCellAddress(emitter, BFC_OFFSET(op), REG_RCX);
+    const u8 bytes[] = { opcode, (u8)((ext << 3) | cell), BFC_VALUE(op) };
+
+    bfvmJitEmitBytes(emitter, bytes, sizeof(bytes));
+}
+
+static void bfvmJitEmitCall(BFJitEmitter *emitter, BFJitIOFn fn, u8 cell, u32 count)
+{
+    const u8 args[] = {
+        0x4C, 0x89, 0xE7,                     /* mov rdi, r12   */
+        0x48, 0x89, (u8)(0xC6 | (cell << 3))  /* mov rsi, cell  */
+    };
+
+    u64 address = 0;
+    memcpy(&address, &fn, sizeof(address));
+
+    bfvmJitEmitBytes(emitter, args, sizeof(args));
+    bfvmJitEmitByte(emitter, 0xBA); /* mov edx, imm32 */
+    bfvmJitEmitU32(emitter, count);
+    bfvmJitEmitBytes(emitter, (const u8[]){ 0x48, 0xB8 }, 2); /* mov rax, imm64 */
+    bfvmJitEmitU64(emitter, address);
+    bfvmJitEmitBytes(emitter, (const u8[]){ 0xFF, 0xD0 }, 2); /* call rax */
+}
+
+static void bfvmJitPatchRel32(BFJitEmitter *emitter, size_t at, size_t target)
+{
+    const i32 rel = (i32)((i64)target - (i64)(at + sizeof(u32)));
+    const u32 bits = (u32)rel;
+
+    for (size_t i = 0; i < sizeof(bits); i++)
+    {
+        emitter->buffer[at + i] = (u8)(bits >> (8 * i));
+    }
+}
+
+#else
+
+BFJitCode *bfvmJitCompile(const BFProgram *program, const BFJitHooks *hooks, BFBool fueled)
+{
+    (void)program;
+    (void)hooks;
+    (void)fueled;
+
+    return NULL;
+}
+
+void bfvmJitFree(BFJitCode *jit)
+{
+    (void)jit;
+}
+
+BFJitStatus bfvmJitExecute(const BFJitCode *jit, u8 *data, void *context, BFJitState *state)
+{
+    (void)jit;
+    (void)data;
+    (void)context;
+    (void)state;
+
+    return BFJIT_OK;
+}
+
+#endif
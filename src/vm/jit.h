@@ -0,0 +1,44 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "core/platform.h"
+#include "core/types.h"
+
+#include <bfc/bfc.h>
+
+typedef struct BFJitCode BFJitCode;
+
+/* count is how many times WRITE outputs the cell; reads always pass 1 */
+typedef void (*BFJitIOFn)(void *context, u8 *cell, u32 count);
+
+typedef struct BFJitHooks
+{
+    BFJitIOFn write;
+    BFJitIOFn read;
+} BFJitHooks;
+
+typedef enum BFJitStatus
+{
+    BFJIT_OK          = 0,
+    BFJIT_OUT_OF_FUEL = 1
+} BFJitStatus;
+
+/*
+ * Where a run starts and how many loop back-edges it may take, which code
+ * compiled with fuel checks stores back when it returns. A run that runs out
+ * of fuel leaves ip at the start of the loop body it was about to enter
+ * again, so executing the same state with more fuel resumes it.
+ */
+typedef struct BFJitState
+{
+    size_t ip;
+    size_t dp;
+    u64    fuel;
+} BFJitState;
+
+BFJitCode *bfvmJitCompile(const BFProgram *program, const BFJitHooks *hooks, BFBool fueled);
+void bfvmJitFree(BFJitCode *jit);
+
+BFJitStatus bfvmJitExecute(const BFJitCode *jit, u8 *data, void *context, BFJitState *state);
+
+#endif /* JIT_H */
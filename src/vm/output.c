@@ -0,0 +1,154 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "output.h"
+
+#include "core/memory.h"
+#include "core/platform.h"
+
+#include <bfc/core/file.h>
+
+#include <string.h>
+
+#if defined(BFVM_WINDOWS)
+#   include <io.h>
+#   define BFVM_ISATTY(FD) _isatty(FD)
+#else
+#   include <unistd.h>
+#   define BFVM_ISATTY(FD) isatty(FD)
+#endif
+
+static BFBool bfvmOutputWriteFd(void *context, const u8 *data, size_t size);
+
+BFOutput *bfvmOutputCreate(int fd, BFBool lineBuffered)
+{
+    BFOutput *const output = bfvmOutputCreateWriter(bfvmOutputWriteFd, NULL, lineBuffered);
+    output->context = &output->fd;
+    output->fd = fd;
+
+    return output;
+}
+
+BFOutput *bfvmOutputCreateWriter(BFWriteFn write, void *context, BFBool lineBuffered)
+{
+    BFOutput *const output = BFVM_MALLOC(BFOutput, 1);
+    output->buffer = BFVM_MALLOC(u8, BFVM_OUTPUT_BUFFER_SIZE);
+    output->pos = 0;
+    output->flushed = 0;
+    output->write = write;
+    output->context = context;
+    output->fd = -1;
+    output->lineBuffered = lineBuffered;
+
+    return output;
+}
+
+void bfvmOutputFree(BFOutput *output)
+{
+    BFVM_FREE(output->buffer);
+    BFVM_FREE(output);
+}
+
+/* drops the buffered bytes and starts counting anew */
+void bfvmOutputReset(BFOutput *output)
+{
+    output->pos = 0;
+    output->flushed = 0;
+}
+
+/* counts on from written bytes, as if they had been written already */
+void bfvmOutputResume(BFOutput *output, u64 written)
+{
+    output->pos = 0;
+    output->flushed = written;
+}
+
+/* appends count copies of byte, flushing whenever the buffer fills up */
+BFBool bfvmOutputPut(BFOutput *output, u8 byte, size_t count)
+{
+    while (count > 0)
+    {
+        if (output->pos == BFVM_OUTPUT_BUFFER_SIZE && !bfvmOutputFlush(output))
+        {
+            return BF_FALSE;
+        }
+
+        const size_t space = BFVM_OUTPUT_BUFFER_SIZE - output->pos;
+        const size_t chunk = (count < space) ? count : space;
+        if (chunk == 1)
+        {
+            output->buffer[output->pos] = byte;
+        }
+        else
+        {
+            memset(output->buffer + output->pos, byte, chunk);
+        }
+
+        output->pos += chunk;
+        count -= chunk;
+    }
+
+    if (output->lineBuffered && byte == '\n')
+    {
+        return bfvmOutputFlush(output);
+    }
+
+    return BF_TRUE;
+}
+
+/* appends size bytes of data, flushing whenever the buffer fills up */
+BFBool bfvmOutputWrite(BFOutput *output, const u8 *data, size_t size)
+{
+    while (size > 0)
+    {
+        if (output->pos == BFVM_OUTPUT_BUFFER_SIZE && !bfvmOutputFlush(output))
+        {
+            return BF_FALSE;
+        }
+
+        const size_t space = BFVM_OUTPUT_BUFFER_SIZE - output->pos;
+        const size_t chunk = (size < space) ? size : space;
+        memcpy(output->buffer + output->pos, data, chunk);
+
+        output->pos += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+
+    return BF_TRUE;
+}
+
+/* on failure the buffered bytes are dropped */
+BFBool bfvmOutputFlush(BFOutput *output)
+{
+    if (output->pos == 0)
+    {
+        return BF_TRUE;
+    }
+
+    const BFBool written = output->write(output->context, output->buffer, output->pos);
+    if (written)
+    {
+        output->flushed += output->pos;
+    }
+
+    output->pos = 0;
+    return written;
+}
+
+/* how many bytes the program has written so far, buffered ones included */
+u64 bfvmOutputWritten(const BFOutput *output)
+{
+    return output->flushed + output->pos;
+}
+
+BFBool bfvmOutputIsTerminal(int fd)
+{
+    return BFVM_ISATTY(fd) ? BF_TRUE : BF_FALSE;
+}
+
+static BFBool bfvmOutputWriteFd(void *context, const u8 *data, size_t size)
+{
+    return bfcWriteAll(*(const int *)context, data, size);
+}
@@ -0,0 +1,45 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "core/types.h"
+
+#define BFVM_OUTPUT_BUFFER_SIZE 65536UL
+#define BFVM_STDOUT_FD          1
+
+/*
+ * Writes all size bytes of data, returning BF_FALSE if that failed.
+ */
+typedef BFBool (*BFWriteFn)(void *context, const u8 *data, size_t size);
+
+/*
+ * Program output collected in a VM-owned buffer and handed to write in large
+ * blocks. The buffer flushes itself when it fills up, and a
+ * line-buffered output also after every newline; the VM flushes it before
+ * the program blocks on input and when the program ends. flushed counts the
+ * bytes handed to write so far.
+ */
+typedef struct BFOutput
+{
+    u8        *buffer;
+    size_t     pos;
+    u64        flushed;
+    BFWriteFn  write;
+    void      *context;
+    int        fd;
+    BFBool     lineBuffered;
+} BFOutput;
+
+BFOutput *bfvmOutputCreate(int fd, BFBool lineBuffered);
+BFOutput *bfvmOutputCreateWriter(BFWriteFn write, void *context, BFBool lineBuffered);
+void bfvmOutputFree(BFOutput *output);
+void bfvmOutputReset(BFOutput *output);
+void bfvmOutputResume(BFOutput *output, u64 written);
+
+BFBool bfvmOutputPut(BFOutput *output, u8 byte, size_t count);
+BFBool bfvmOutputWrite(BFOutput *output, const u8 *data, size_t size);
+BFBool bfvmOutputFlush(BFOutput *output);
+u64 bfvmOutputWritten(const BFOutput *output);
+
+BFBool bfvmOutputIsTerminal(int fd);
+
+#endif /* OUTPUT_H */
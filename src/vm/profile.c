@@ -0,0 +1,291 @@
+#include "profile.h"
+
+#include "core/error.h"
+#include "core/memory.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a loop of the program and what it cost, JNZ running once per iteration */
+typedef struct BFProfileLoop
+{
+    size_t open;
+    size_t depth;
+    u64    entries;
+    u64    iterations;
+    u64    instructions;
+} BFProfileLoop;
+
+static const char *const s_InstrNames[] = {
+    [BFC_ADDB]  = "ADDB",
+    [BFC_SUBB]  = "SUBB",
+    [BFC_ADDP]  = "ADDP",
+    [BFC_SUBP]  = "SUBP",
+    [BFC_WRITE] = "WRITE",
+    [BFC_READ]  = "READ",
+    [BFC_JZ]    = "JZ",
+    [BFC_JNZ]   = "JNZ",
+    [BFC_SET]   = "SET",
+    [BFC_SCAN]  = "SCAN",
+    [BFC_MUL]   = "MUL",
+    [BFC_END]   = "END"
+};
+
+static BFProfileLoop *bfvmProfileLoops(const BFProfile *profile, const BFProgram *program, size_t *count);
+static BFBool bfvmProfileSameSource(const BFProgram *program, size_t a, size_t b);
+static void bfvmProfileWriteStack(FILE *file, const BFProgram *program, const char *programName, const size_t *open, size_t depth, size_t ip, u64 count);
+static void bfvmProfileWriteFrame(FILE *file, const char *name);
+static int bfvmProfileCompareLoops(const void *a, const void *b);
+
+BFProfile *bfvmProfileCreate(const BFProgram *program)
+{
+    BFProfile *const profile = BFVM_MALLOC(BFProfile, 1);
+    profile->hits = BFVM_CALLOC(u64, program->size + 1);
+    profile->size = program->size;
+    profile->minPointer = 0;
+    profile->maxPointer = 0;
+
+    return profile;
+}
+
+void bfvmProfileFree(BFProfile *profile)
+{
+    BFVM_FREE(profile->hits);
+    BFVM_FREE(profile);
+}
+
+void bfvmProfileReset(BFProfile *profile)
+{
+    memset(profile->hits, 0, sizeof(u64) * (profile->size + 1));
+    profile->minPointer = 0;
+    profile->maxPointer = 0;
+}
+
+u64 bfvmProfileTotal(const BFProfile *profile)
+{
+    u64 total = 0;
+    for (size_t ip = 0; ip < profile->size; ip++)
+    {
+        total += profile->hits[ip];
+    }
+
+    return total;
+}
+
+/* prints how often each kind of instruction ran to stderr */
+void bfvmProfilePrintMix(const BFProfile *profile, const BFProgram *program)
+{
+    u64 byInstr[BFC_END] = { 0 };
+    for (size_t ip = 0; ip < program->size; ip += BFC_WIDTH(program->code[ip]))
+    {
+        byInstr[BFC_INSTR(program->code[ip])] += profile->hits[ip];
+    }
+
+    const u64 total = bfvmProfileTotal(profile);
+    const double scale = (total > 0) ? 100.0 / (double)total : 0.0;
+
+    fprintf(stderr, "\n  %-8s %20s %8s\n", "instr", "dispatched", "share");
+    for (size_t i = 0; i < BFC_END; i++)
+    {
+        if (byInstr[i] > 0)
+        {
+            fprintf(stderr, "  %-8s %20llu %7.2f%%\n", s_InstrNames[i], (unsigned long long)byInstr[i], (double)byInstr[i] * scale);
+        }
+    }
+}
+
+/*
+ * Prints how often each kind of instruction ran and the loops that ran the
+ * most instructions, nested loops included, to stderr.
+ */
+void bfvmProfileReport(const BFProfile *profile, const BFProgram *program, const char *programName)
+{
+    const u64 total = bfvmProfileTotal(profile);
+    const double scale = (total > 0) ? 100.0 / (double)total : 0.0;
+
+    bfvmPrintInfo("profile of %s: %llu instructions dispatched", programName, (unsigned long long)total);
+    bfvmProfilePrintMix(profile, program);
+
+    size_t loopCount = 0;
+    BFProfileLoop *const loops = bfvmProfileLoops(profile, program, &loopCount);
+    qsort(loops, loopCount, sizeof(BFProfileLoop), bfvmProfileCompareLoops);
+
+    fprintf(stderr, "\n  %-16s %6s %14s %16s %20s %8s\n", "hot loop", "depth", "entries", "iterations", "instructions", "share");
+    for (size_t i = 0; i < loopCount && i < BFVM_PROFILE_HOT_LOOPS && loops[i].entries > 0; i++)
+    {
+        char location[BFVM_LOCATION_SIZE];
+        bfvmProfileLocate(program, loops[i].open, location);
+
+        fprintf(stderr, "  %-16s %6zu %14llu %16llu %20llu %7.2f%%\n",
+                location,
+                loops[i].depth,
+                (unsigned long long)loops[i].entries,
+                (unsigned long long)loops[i].iterations,
+                (unsigned long long)loops[i].instructions,
+                (double)loops[i].instructions * scale);
+    }
+
+    fprintf(stderr, "\n");
+    BFVM_FREE(loops);
+}
+
+/*
+ * Writes one line per executed instruction in the folded format flame graph
+ * tools read: the program, then every enclosing loop from the outermost in,
+ * then the instruction, each frame named after its source position, followed
+ * by how often the instruction ran. Neighbouring instructions of one kind that
+ * came from the same token, such as the MULs of one loop, share a line.
+ */
+BFBool bfvmProfileWriteFolded(const BFProfile *profile, const BFProgram *program, const char *programName, const char *filepath)
+{
+    FILE *const file = fopen(filepath, "w");
+    if (!file)
+    {
+        return BF_FALSE;
+    }
+
+    size_t *const open = BFVM_MALLOC(size_t, program->loopCount + 1);
+    size_t depth = 0;
+    size_t pending = 0;
+    u64 pendingCount = 0;
+
+    for (size_t ip = 0; ip < program->size; ip += BFC_WIDTH(program->code[ip]))
+    {
+        const BFInstr instr = BFC_INSTR(program->code[ip]);
+        const u64 hits = profile->hits[ip];
+        const BFBool boundary = instr == BFC_JZ || instr == BFC_JNZ;
+
+        /* a line never spans a loop boundary, as its stack would change there */
+        if (pendingCount > 0 && (boundary || (hits > 0 && !bfvmProfileSameSource(program, pending, ip))))
+        {
+            bfvmProfileWriteStack(file, program, programName, open, depth, pending, pendingCount);
+            pendingCount = 0;
+        }
+
+        if (instr == BFC_JZ)
+        {
+            open[depth++] = ip;
+        }
+
+        if (hits > 0 && pendingCount == 0)
+        {
+            pending = ip;
+        }
+
+        pendingCount += hits;
+
+        if (instr == BFC_JNZ)
+        {
+            if (pendingCount > 0)
+            {
+                bfvmProfileWriteStack(file, program, programName, open, depth, pending, pendingCount);
+                pendingCount = 0;
+            }
+
+            depth--;
+        }
+    }
+
+    if (pendingCount > 0)
+    {
+        bfvmProfileWriteStack(file, program, programName, open, depth, pending, pendingCount);
+    }
+
+    BFVM_FREE(open);
+    return fclose(file) == 0;
+}
+
+/* line:column when the program was compiled with a source map, the word index otherwise */
+void bfvmProfileLocate(const BFProgram *program, size_t ip, char *location)
+{
+    if (program->positions)
+    {
+        snprintf(location, BFVM_LOCATION_SIZE, "%zu:%zu", program->positions[ip].line, program->positions[ip].column);
+    }
+    else
+    {
+        snprintf(location, BFVM_LOCATION_SIZE, "#%zu", ip);
+    }
+}
+
+/*
+ * Pairs every JZ with its JNZ. The instructions of a loop are the sum of the
+ * hits between the two, which a running total gives without a second pass.
+ */
+static BFProfileLoop *bfvmProfileLoops(const BFProfile *profile, const BFProgram *program, size_t *count)
+{
+    BFProfileLoop *const loops = BFVM_MALLOC(BFProfileLoop, program->loopCount + 1);
+    size_t *const open = BFVM_MALLOC(size_t, program->loopCount + 1);
+    size_t depth = 0;
+    size_t loopCount = 0;
+    u64 total = 0;
+
+    for (size_t ip = 0; ip < program->size; ip += BFC_WIDTH(program->code[ip]))
+    {
+        const BFInstr instr = BFC_INSTR(program->code[ip]);
+        if (instr == BFC_JZ)
+        {
+            BFProfileLoop *const loop = &loops[loopCount];
+            loop->open = ip;
+            loop->depth = depth + 1;
+            loop->entries = profile->hits[ip];
+            loop->instructions = total;
+            open[depth++] = loopCount++;
+        }
+
+        total += profile->hits[ip];
+
+        if (instr == BFC_JNZ)
+        {
+            BFProfileLoop *const loop = &loops[open[--depth]];
+            loop->iterations = profile->hits[ip];
+            loop->instructions = total - loop->instructions;
+        }
+    }
+
+    BFVM_FREE(open);
+
+    *count = loopCount;
+    return loops;
+}
+
+/* without a source map every instruction is its own location */
+static BFBool bfvmProfileSameSource(const BFProgram *program, size_t a, size_t b)
+{
+    return program->positions
+        && BFC_INSTR(program->code[a]) == BFC_INSTR(program->code[b])
+        && program->positions[a].line == program->positions[b].line
+        && program->positions[a].column == program->positions[b].column;
+}
+
+static void bfvmProfileWriteStack(FILE *file, const BFProgram *program, const char *programName, const size_t *open, size_t depth, size_t ip, u64 count)
+{
+    char location[BFVM_LOCATION_SIZE];
+
+    bfvmProfileWriteFrame(file, programName);
+    for (size_t i = 0; i < depth; i++)
+    {
+        bfvmProfileLocate(program, open[i], location);
+        fprintf(file, ";loop@%s", location);
+    }
+
+    bfvmProfileLocate(program, ip, location);
+    fprintf(file, ";%s@%s %llu\n", s_InstrNames[BFC_INSTR(program->code[ip])], location, (unsigned long long)count);
+}
+
+/* ';' separates frames and a space ends the stack, so neither may appear in a name */
+static void bfvmProfileWriteFrame(FILE *file, const char *name)
+{
+    for (; *name != '\0'; name++)
+    {
+        fputc((*name == ';' || *name == ' ') ? '_' : *name, file);
+    }
+}
+
+static int bfvmProfileCompareLoops(const void *a, const void *b)
+{
+    const u64 x = ((const BFProfileLoop *)a)->instructions;
+    const u64 y = ((const BFProfileLoop *)b)->instructions;
+    return (x < y) - (x > y);
+}
@@ -0,0 +1,40 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "core/types.h"
+
+#include <bfc/bfc.h>
+
+#define BFVM_PROFILE_EXTENSION ".folded"
+#define BFVM_PROFILE_HOT_LOOPS 10
+#define BFVM_LOCATION_SIZE     48
+
+/*
+ * Execution counts of one run. hits holds one counter per word of the
+ * program, but only the first word of an instruction is ever counted, so the
+ * sum over a range of words is the number of instructions dispatched in it.
+ * minPointer and maxPointer are the lowest and highest cells the data pointer
+ * has reached.
+ */
+typedef struct BFProfile
+{
+    u64    *hits;
+    size_t  size;
+    size_t  minPointer;
+    size_t  maxPointer;
+} BFProfile;
+
+BFProfile *bfvmProfileCreate(const BFProgram *program);
+void bfvmProfileFree(BFProfile *profile);
+void bfvmProfileReset(BFProfile *profile);
+
+u64 bfvmProfileTotal(const BFProfile *profile);
+void bfvmProfilePrintMix(const BFProfile *profile, const BFProgram *program);
+
+void bfvmProfileReport(const BFProfile *profile, const BFProgram *program, const char *programName);
+BFBool bfvmProfileWriteFolded(const BFProfile *profile, const BFProgram *program, const char *programName, const char *filepath);
+
+/* location has to hold BFVM_LOCATION_SIZE characters */
+void bfvmProfileLocate(const BFProgram *program, size_t ip, char *location);
+
+#endif /* PROFILE_H */
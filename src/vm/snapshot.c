@@ -0,0 +1,274 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "snapshot.h"
+
+#include "core/memory.h"
+#include "core/platform.h"
+
+#include <bfc/core/file.h>
+#include <bfc/core/hash.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(BFVM_WINDOWS)
+#   include <errno.h>
+#   include <sys/wait.h>
+#   include <unistd.h>
+#endif
+
+#define BFVM_SNAPSHOT_BUFFER_SIZE 16384
+
+/*
+ * Buffered writes straight to a descriptor. Writing a snapshot allocates
+ * nothing and takes no locks, so a forked copy of a threaded process can do
+ * it safely.
+ */
+typedef struct BFSnapshotWriter
+{
+    int    fd;
+    size_t pos;
+    BFBool failed;
+    u8     buffer[BFVM_SNAPSHOT_BUFFER_SIZE];
+} BFSnapshotWriter;
+
+static BFBool bfvmSnapshotWrite(int fd, const BFSnapshotHeader *header, const BFTape *tape);
+static void bfvmSnapshotPut(BFSnapshotWriter *writer, const void *data, size_t size);
+static void bfvmSnapshotFlush(BFSnapshotWriter *writer);
+static BFBool bfvmSnapshotCellIsZero(const u8 *cell, size_t cellSize);
+
+/* a hash of the code, so a snapshot never resumes a program compiled differently */
+u64 bfvmSnapshotKey(const BFProgram *program)
+{
+    const u64 hash = bfcHashBytes(BFC_HASH_SEED, program->code, (program->size + 1) * sizeof(BFOpCode));
+    return bfcHashBytes(hash, &program->cellBits, sizeof(program->cellBits));
+}
+
+/*
+ * The snapshot replaces filepath the way bfcCommitReplacement does, so an
+ * earlier snapshot there survives until the new one is complete and synced.
+ * With a writer, the file is written by a forked copy of the process, whose
+ * id is stored in writer, and the caller carries on meanwhile; the copy sees
+ * the tape as it was at the fork whatever the caller does to it. Where there
+ * is no fork, or it fails, the snapshot is written before returning.
+ */
+BFBool bfvmSnapshotSave(const BFSnapshotHeader *header, const BFTape *tape, const char *filepath, long *writer)
+{
+    char *const tempPath = bfcReplacementPath(filepath);
+    const int fd = bfcOpenReplacement(tempPath);
+    if (fd < 0)
+    {
+        BFVM_FREE(tempPath);
+        return BF_FALSE;
+    }
+
+#if defined(BFVM_WINDOWS)
+    (void)writer;
+#else
+    if (writer)
+    {
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            const BFBool committed = bfcCommitReplacement(fd, tempPath, filepath, bfvmSnapshotWrite(fd, header, tape));
+            _exit(committed ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        if (pid > 0)
+        {
+            close(fd);
+            BFVM_FREE(tempPath);
+            *writer = (long)pid;
+            return BF_TRUE;
+        }
+    }
+#endif
+
+    const BFBool committed = bfcCommitReplacement(fd, tempPath, filepath, bfvmSnapshotWrite(fd, header, tape));
+    BFVM_FREE(tempPath);
+    return committed;
+}
+
+/* returns whether the snapshot the writer was writing made it to its file */
+BFBool bfvmSnapshotWait(long *writer)
+{
+#if defined(BFVM_WINDOWS)
+    (void)writer;
+    return BF_TRUE;
+#else
+    if (*writer <= 0)
+    {
+        return BF_TRUE;
+    }
+
+    int status = 0;
+    pid_t pid = 0;
+    do
+    {
+        pid = waitpid((pid_t)*writer, &status, 0);
+    }
+    while (pid < 0 && errno == EINTR);
+
+    *writer = 0;
+    return (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) ? BF_TRUE : BF_FALSE;
+#endif
+}
+
+/*
+ * Opens a snapshot and reads its header, leaving the file at the tape.
+ * Only the framing is checked here; whether the snapshot fits the virtual
+ * machine is up to the caller.
+ */
+FILE *bfvmSnapshotOpen(const char *filepath, BFSnapshotHeader *header, BFSnapshotStatus *status)
+{
+    FILE *const file = fopen(filepath, "rb");
+    if (!file)
+    {
+        *status = BFVM_SNAPSHOT_UNREADABLE;
+        return NULL;
+    }
+
+    if (fread(header, sizeof(*header), 1, file) != 1 ||
+        header->magic != BFVM_SNAPSHOT_MAGIC ||
+        header->version != BFVM_SNAPSHOT_VERSION ||
+        header->byteOrder != BFVM_SNAPSHOT_BYTE_ORDER)
+    {
+        *status = ferror(file) ? BFVM_SNAPSHOT_UNREADABLE : BFVM_SNAPSHOT_INVALID;
+        fclose(file);
+        return NULL;
+    }
+
+    *status = BFVM_SNAPSHOT_OK;
+    return file;
+}
+
+/* tape has to hold at least header->tapeSize cells already */
+BFBool bfvmSnapshotLoadTape(FILE *file, const BFSnapshotHeader *header, BFTape *tape)
+{
+    const size_t cellSize = tape->cellSize;
+    u64 index = 0;
+
+    bfvmTapeClear(tape);
+    for (;;)
+    {
+        BFSnapshotRun run;
+        if (fread(&run, sizeof(run), 1, file) != 1)
+        {
+            return BF_FALSE;
+        }
+
+        if (run.count == 0)
+        {
+            return BF_TRUE;
+        }
+
+        if (run.skip > header->tapeSize - index || run.count > header->tapeSize - index - run.skip)
+        {
+            return BF_FALSE;
+        }
+
+        index += run.skip;
+        if (fread(tape->cells + (index * cellSize), cellSize, (size_t)run.count, file) != run.count)
+        {
+            return BF_FALSE;
+        }
+
+        index += run.count;
+    }
+}
+
+/* a run ends once it meets more zero cells than a new run would take up */
+static BFBool bfvmSnapshotWrite(int fd, const BFSnapshotHeader *header, const BFTape *tape)
+{
+    BFSnapshotWriter writer;
+    writer.fd = fd;
+    writer.pos = 0;
+    writer.failed = BF_FALSE;
+
+    bfvmSnapshotPut(&writer, header, sizeof(*header));
+
+    const size_t cellSize = tape->cellSize;
+    const size_t size = tape->size;
+    const size_t gap = (sizeof(BFSnapshotRun) / cellSize) + 1;
+    size_t index = 0;
+
+    for (;;)
+    {
+        size_t start = index;
+        while (start < size && bfvmSnapshotCellIsZero(tape->cells + (start * cellSize), cellSize))
+        {
+            start++;
+        }
+
+        if (start == size)
+        {
+            break;
+        }
+
+        size_t last = start;
+        for (size_t i = start + 1; i < size && i - last < gap; i++)
+        {
+            if (!bfvmSnapshotCellIsZero(tape->cells + (i * cellSize), cellSize))
+            {
+                last = i;
+            }
+        }
+
+        const BFSnapshotRun run = { start - index, last + 1 - start };
+        bfvmSnapshotPut(&writer, &run, sizeof(run));
+        bfvmSnapshotPut(&writer, tape->cells + (start * cellSize), (size_t)run.count * cellSize);
+        index = last + 1;
+    }
+
+    const BFSnapshotRun end = { 0, 0 };
+    bfvmSnapshotPut(&writer, &end, sizeof(end));
+    bfvmSnapshotFlush(&writer);
+
+    return !writer.failed;
+}
+
+static void bfvmSnapshotPut(BFSnapshotWriter *writer, const void *data, size_t size)
+{
+    const u8 *bytes = (const u8 *)data;
+    while (size > 0)
+    {
+        if (writer->pos == BFVM_SNAPSHOT_BUFFER_SIZE)
+        {
+            bfvmSnapshotFlush(writer);
+        }
+
+        const size_t space = BFVM_SNAPSHOT_BUFFER_SIZE - writer->pos;
+        const size_t chunk = (size < space) ? size : space;
+        memcpy(writer->buffer + writer->pos, bytes, chunk);
+
+        writer->pos += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+/* after a failed write the rest is dropped, and the snapshot is discarded */
+static void bfvmSnapshotFlush(BFSnapshotWriter *writer)
+{
+    if (!writer->failed && !bfcWriteAll(writer->fd, writer->buffer, writer->pos))
+    {
+        writer->failed = BF_TRUE;
+    }
+
+    writer->pos = 0;
+}
+
+static BFBool bfvmSnapshotCellIsZero(const u8 *cell, size_t cellSize)
+{
+    for (size_t i = 0; i < cellSize; i++)
+    {
+        if (cell[i] != 0)
+        {
+            return BF_FALSE;
+        }
+    }
+
+    return BF_TRUE;
+}
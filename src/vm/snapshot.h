@@ -0,0 +1,55 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "bfvm.h"
+#include "tape.h"
+
+#include <stdio.h>
+
+#define BFVM_SNAPSHOT_EXTENSION ".bfsnap"
+
+/*
+ * A snapshot is a BFSnapshotHeader followed by the tape, in the byte order of
+ * the machine that wrote it. The tape is stored as runs, each a
+ * BFSnapshotRun followed by count cells: skip zero cells are left out, then
+ * count cells follow as they are. A run of no cells ends the tape. Stretches
+ * of zero cells shorter than a BFSnapshotRun stay inside the run around them.
+ *
+ * program is bfvmSnapshotKey of the program the snapshot was taken of, input
+ * and output how many bytes it had read and written, and tapeSize how many
+ * cells the tape had.
+ */
+#define BFVM_SNAPSHOT_MAGIC      0x53564642UL /* "BFVS" */
+#define BFVM_SNAPSHOT_VERSION    1UL
+#define BFVM_SNAPSHOT_BYTE_ORDER 0x01020304UL
+
+typedef struct BFSnapshotHeader
+{
+    u32 magic;
+    u32 version;
+    u32 byteOrder;
+    u8  cellBits;
+    u8  reserved[3];
+    u64 program;
+    u64 ip;
+    u64 dp;
+    u64 tapeSize;
+    u64 input;
+    u64 output;
+} BFSnapshotHeader;
+
+typedef struct BFSnapshotRun
+{
+    u64 skip;
+    u64 count;
+} BFSnapshotRun;
+
+u64 bfvmSnapshotKey(const BFProgram *program);
+
+BFBool bfvmSnapshotSave(const BFSnapshotHeader *header, const BFTape *tape, const char *filepath, long *writer);
+BFBool bfvmSnapshotWait(long *writer);
+
+FILE *bfvmSnapshotOpen(const char *filepath, BFSnapshotHeader *header, BFSnapshotStatus *status);
+BFBool bfvmSnapshotLoadTape(FILE *file, const BFSnapshotHeader *header, BFTape *tape);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,304 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+#include "tape.h"
+
+#include "core/memory.h"
+
+#include <string.h>
+
+#if defined(BFVM_WINDOWS)
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#endif
+
+#if defined(BFVM_GUARD_PAGES)
+#   include <pthread.h>
+#   include <signal.h>
+#   include <sys/mman.h>
+#endif
+
+/* how far a growable tape may extend, in cells */
+#define BFVM_TAPE_RESERVE   ((size_t)1 << 30)
+
+/* smallest guard region on either side of the tape, in bytes */
+#define BFVM_MIN_GUARD_SIZE ((size_t)1 << 16)
+
+#define BFVM_ROUND_UP(N, M) ((((N) + (M) - 1) / (M)) * (M))
+
+static size_t bfvmTapePageSize(void);
+static size_t bfvmTapeGrowSize(const BFTape *tape, size_t index);
+
+#if defined(BFVM_GUARD_PAGES)
+
+static BFVM_THREAD_LOCAL BFTape *s_ActiveTape = NULL;
+static pthread_once_t s_HandlerOnce = PTHREAD_ONCE_INIT;
+static struct sigaction s_PreviousSegv;
+static struct sigaction s_PreviousBus;
+
+static void bfvmTapeInstallHandler(void);
+static void bfvmTapeFaultHandler(int sig, siginfo_t *info, void *context);
+static void bfvmTapeForwardFault(int sig, siginfo_t *info, void *context);
+
+/*
+ * The guard on each side has to be wider than the furthest the program can
+ * address past the last cell it read (see BFProgram.reach); otherwise a large
+ * pointer move could skip over it into unrelated memory.
+ */
+BFTape *bfvmTapeCreate(size_t size, size_t cellSize, BFBool growable, size_t reach)
+{
+    const size_t pageSize = bfvmTapePageSize();
+    const size_t pageCells = pageSize / cellSize;
+    const size_t reachBytes = (reach + 1) * cellSize;
+    const size_t guard = BFVM_ROUND_UP((reachBytes > BFVM_MIN_GUARD_SIZE) ? reachBytes : BFVM_MIN_GUARD_SIZE, pageSize);
+
+    size = BFVM_ROUND_UP((size > 0) ? size : 1, pageCells);
+    const size_t limit = growable ? BFVM_ROUND_UP((size > BFVM_TAPE_RESERVE) ? size : BFVM_TAPE_RESERVE, pageCells) : size;
+
+    if (limit > (SIZE_MAX - (2 * guard)) / cellSize)
+    {
+        return NULL;
+    }
+
+    const size_t regionSize = guard + (limit * cellSize) + guard;
+    void *const region = mmap(NULL, regionSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    u8 *const cells = (u8 *)region + guard;
+    BFTape *const tape = BFVM_TRY_MALLOC(BFTape, 1);
+    if (!tape || mprotect(cells, size * cellSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        BFVM_FREE(tape);
+        munmap(region, regionSize);
+        return NULL;
+    }
+
+    tape->cells = cells;
+    tape->size = size;
+    tape->limit = limit;
+    tape->cellSize = cellSize;
+    tape->growable = growable;
+    tape->region = (u8 *)region;
+    tape->regionSize = regionSize;
+    tape->pageSize = pageSize;
+    tape->previous = NULL;
+
+    return tape;
+}
+
+void bfvmTapeFree(BFTape *tape)
+{
+    bfvmTapeDisarm(tape);
+    munmap(tape->region, tape->regionSize);
+    BFVM_FREE(tape);
+}
+
+BFBool bfvmTapeEnsure(BFTape *tape, size_t index)
+{
+    if (index < tape->size)
+    {
+        return BF_TRUE;
+    }
+
+    const size_t size = bfvmTapeGrowSize(tape, index);
+    const size_t cellSize = tape->cellSize;
+    if (size == 0 || mprotect(tape->cells + (tape->size * cellSize), (size - tape->size) * cellSize, PROT_READ | PROT_WRITE) != 0)
+    {
+        return BF_FALSE;
+    }
+
+    tape->size = size;
+    return BF_TRUE;
+}
+
+void bfvmTapeArm(BFTape *tape)
+{
+    pthread_once(&s_HandlerOnce, bfvmTapeInstallHandler);
+
+    tape->previous = s_ActiveTape;
+    s_ActiveTape = tape;
+}
+
+void bfvmTapeDisarm(BFTape *tape)
+{
+    if (s_ActiveTape != tape)
+    {
+        return;
+    }
+
+    s_ActiveTape = tape->previous;
+    tape->previous = NULL;
+}
+
+/*
+ * The fault handler is installed the first time any thread arms a tape and
+ * stays in place, since other threads may be running tapes of their own;
+ * faults that are not ours are passed on to whatever handler was there
+ * before.
+ */
+static void bfvmTapeInstallHandler(void)
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = bfvmTapeFaultHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    sigaction(SIGSEGV, &action, &s_PreviousSegv);
+    sigaction(SIGBUS, &action, &s_PreviousBus);
+}
+
+/*
+ * Faults inside the reserved region of the tape armed on the faulting thread
+ * are ours: the reserved tail of a growable tape is committed and the
+ * faulting access retried, anything else unwinds to the engine's fault
+ * buffer.
+ */
+static void bfvmTapeFaultHandler(int sig, siginfo_t *info, void *context)
+{
+    BFTape *const tape = s_ActiveTape;
+    const u8 *const address = (const u8 *)info->si_addr;
+    if (!tape || address < tape->region || address >= tape->region + tape->regionSize)
+    {
+        bfvmTapeForwardFault(sig, info, context);
+        return;
+    }
+
+    if (address >= tape->cells && bfvmTapeEnsure(tape, (size_t)(address - tape->cells) / tape->cellSize))
+    {
+        return;
+    }
+
+    siglongjmp(tape->fault, 1);
+}
+
+/*
+ * Hands a fault to the handler installed before ours. A default disposition
+ * is restored instead, so that returning re-raises the fault as usual.
+ */
+static void bfvmTapeForwardFault(int sig, siginfo_t *info, void *context)
+{
+    const struct sigaction *const previous = (sig == SIGBUS) ? &s_PreviousBus : &s_PreviousSegv;
+    if (previous->sa_flags & SA_SIGINFO)
+    {
+        previous->sa_sigaction(sig, info, context);
+    }
+    else if (previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN)
+    {
+        previous->sa_handler(sig);
+    }
+    else
+    {
+        sigaction(sig, previous, NULL);
+    }
+}
+
+#else
+
+/* rounded up to whole pages like a guarded tape, so a program has the same tape everywhere */
+BFTape *bfvmTapeCreate(size_t size, size_t cellSize, BFBool growable, size_t reach)
+{
+    (void)reach;
+
+    const size_t pageSize = bfvmTapePageSize();
+    const size_t pageCells = pageSize / cellSize;
+
+    size = BFVM_ROUND_UP((size > 0) ? size : 1, pageCells);
+
+    BFTape *const tape = BFVM_TRY_MALLOC(BFTape, 1);
+    u8 *const cells = (tape && size <= SIZE_MAX / cellSize) ? BFVM_TRY_CALLOC(u8, size * cellSize) : NULL;
+    if (!cells)
+    {
+        BFVM_FREE(tape);
+        return NULL;
+    }
+
+    tape->cells = cells;
+    tape->size = size;
+    tape->limit = growable ? BFVM_ROUND_UP((size > BFVM_TAPE_RESERVE) ? size : BFVM_TAPE_RESERVE, pageCells) : size;
+    tape->cellSize = cellSize;
+    tape->growable = growable;
+    tape->pageSize = pageSize;
+
+    return tape;
+}
+
+void bfvmTapeFree(BFTape *tape)
+{
+    BFVM_FREE(tape->cells);
+    BFVM_FREE(tape);
+}
+
+BFBool bfvmTapeEnsure(BFTape *tape, size_t index)
+{
+    if (index < tape->size)
+    {
+        return BF_TRUE;
+    }
+
+    const size_t size = bfvmTapeGrowSize(tape, index);
+    u8 *const cells = (size > 0) ? BFVM_TRY_REALLOC(u8, tape->cells, size * tape->cellSize) : NULL;
+    if (!cells)
+    {
+        return BF_FALSE;
+    }
+
+    tape->cells = cells;
+    memset(tape->cells + (tape->size * tape->cellSize), 0, (size - tape->size) * tape->cellSize);
+    tape->size = size;
+
+    return BF_TRUE;
+}
+
+void bfvmTapeArm(BFTape *tape)
+{
+    (void)tape;
+}
+
+void bfvmTapeDisarm(BFTape *tape)
+{
+    (void)tape;
+}
+
+#endif
+
+/* cells the program never reached are still zero, so only [0, size) is cleared */
+void bfvmTapeClear(BFTape *tape)
+{
+    memset(tape->cells, 0, tape->size * tape->cellSize);
+}
+
+static size_t bfvmTapePageSize(void)
+{
+#if defined(BFVM_WINDOWS)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (size_t)info.dwPageSize;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+/* doubles the tape until index fits, or returns 0 if it never can */
+static size_t bfvmTapeGrowSize(const BFTape *tape, size_t index)
+{
+    if (!tape->growable || index >= tape->limit)
+    {
+        return 0;
+    }
+
+    size_t size = tape->size;
+    while (size <= index)
+    {
+        size = (size > tape->limit / 2) ? tape->limit : size * 2;
+    }
+
+    size = BFVM_ROUND_UP(size, tape->pageSize / tape->cellSize);
+
+    return (size < tape->limit) ? size : tape->limit;
+}
@@ -0,0 +1,65 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include "core/platform.h"
+#include "core/types.h"
+
+#if defined(BFVM_GUARD_PAGES)
+#   include <setjmp.h>
+#endif
+
+#define BFVM_DEFAULT_TAPE_SIZE 30000UL
+
+/*
+ * The data tape of cellSize-byte cells. Cells [0, size) are addressable; a
+ * growable tape extends itself on demand up to limit cells. Both are whole
+ * pages on every platform.
+ *
+ * With BFVM_GUARD_PAGES the cells live inside a reserved region flanked by
+ * inaccessible guard pages, so the engines never compare the data pointer
+ * against the tape bounds: a stray access faults, and the fault handler
+ * either commits more of the region or jumps back to the fault buffer armed
+ * with BFVM_TAPE_FAULTED. Without guard pages the engines call
+ * bfvmTapeEnsure before touching a cell outside [0, size). Either way moving
+ * the data pointer off the tape is only an error once a cell there is
+ * accessed.
+ *
+ * bfvmTapeCreate returns NULL if the tape cannot be reserved or allocated,
+ * and bfvmTapeEnsure returns BF_FALSE if it cannot grow, for running out of
+ * memory as much as for reaching limit.
+ *
+ * The armed tape is tracked per thread, and arming a tape while another one
+ * is armed on the same thread stacks it on top until it is disarmed again.
+ */
+typedef struct BFTape
+{
+    u8              *cells;
+    volatile size_t  size;
+    size_t           limit;
+    size_t           cellSize;
+    BFBool           growable;
+    size_t           pageSize;
+#if defined(BFVM_GUARD_PAGES)
+    u8              *region;
+    size_t           regionSize;
+    sigjmp_buf       fault;
+    struct BFTape   *previous;
+#endif
+} BFTape;
+
+#if defined(BFVM_GUARD_PAGES)
+#   define BFVM_TAPE_FAULTED(TAPE) (sigsetjmp((TAPE)->fault, 1) != 0)
+#else
+#   define BFVM_TAPE_FAULTED(TAPE) ((void)(TAPE), BF_FALSE)
+#endif
+
+BFTape *bfvmTapeCreate(size_t size, size_t cellSize, BFBool growable, size_t reach);
+void bfvmTapeFree(BFTape *tape);
+
+BFBool bfvmTapeEnsure(BFTape *tape, size_t index);
+void bfvmTapeClear(BFTape *tape);
+
+void bfvmTapeArm(BFTape *tape);
+void bfvmTapeDisarm(BFTape *tape);
+
+#endif /* TAPE_H */
@@ -0,0 +1,140 @@
+/*
+ * Every engine has to agree with the switch loop on what a program writes
+ * and how its run ends, for every cell width, EOF mode and optimization
+ * level. Runs are fueled, so programs that never end under some EOF mode
+ * still compare where they stopped.
+ */
+#include "test.h"
+
+#include "core/memory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BFVM_TEST_FUEL 2000000ULL
+
+typedef struct BFEngineTestProgram
+{
+    const char *name;
+    const char *source;
+} BFEngineTestProgram;
+
+/* file names are read from the tests directory, the rest are the source itself */
+static const BFEngineTestProgram s_Programs[] = {
+    { "hello.b",      NULL },
+    { "beer.b",       NULL },
+    { "bitwidth.b",   NULL },
+    { "curse.b",      NULL },
+    { "nested.b",     NULL },
+    { "sierpinski.b", NULL },
+    { "welcome.b",    NULL },
+    { "cat",          ",[.,]" },
+    { "cat-minus",    ",+[-.,+]" },
+    { "last-read",    "++++++++++++++++++++++++++++++[>,<-]>." },
+    { "echo-cells",   "+[>,]<[<]>[.>]" },
+    { "wrap",         "-.>--[<+>-]<." },
+    { "scan-mul",     ",[->+>++>+++<<<]>>>[<]>[.>]<<<<[>]" }
+};
+
+static const BFEngine s_Engines[] = {
+    BFVM_ENGINE_THREADED,
+    BFVM_ENGINE_JIT,
+    BFVM_ENGINE_PROFILED
+};
+
+static const u8 s_CellBits[] = { 8, 16, 32 };
+static const BFEofMode s_EofModes[] = { BFVM_EOF_UNCHANGED, BFVM_EOF_ZERO, BFVM_EOF_MINUS_ONE };
+static const BFOptLevel s_Levels[] = { BFC_OPT_NONE, BFC_OPT_PEEPHOLE, BFC_OPT_DATAFLOW };
+
+static const char s_Input[] = "The quick brown fox\njumps over the lazy dog.\n";
+
+static BFRunStatus bfvmEngineTestRun(const BFProgram *program, BFEngine engine, BFEofMode eof, BFTestBuffer *output);
+
+int main(void)
+{
+    for (size_t p = 0; p < sizeof(s_Programs) / sizeof(s_Programs[0]); p++)
+    {
+        const BFEngineTestProgram *const test = &s_Programs[p];
+
+        BFTestBuffer source;
+        if (test->source)
+        {
+            bfvmTestInitBuffer(&source, test->source, strlen(test->source));
+        }
+        else
+        {
+            char *const path = bfvmTestSourcePath(test->name);
+            BFVM_CHECK(bfvmTestReadFile(path, &source));
+            BFVM_FREE(path);
+        }
+
+        for (size_t l = 0; l < sizeof(s_Levels) / sizeof(s_Levels[0]); l++)
+        {
+            for (size_t c = 0; c < sizeof(s_CellBits) / sizeof(s_CellBits[0]); c++)
+            {
+                const BFCompileOptions options = { s_Levels[l], s_CellBits[c], NULL, BF_FALSE, BFC_DEFAULT_PREFIX_STEPS, NULL };
+                BFCompileStatus status = BFC_COMPILE_OK;
+                BFProgram *const program = bfcCompileSource(test->name, (const char *)source.data, source.size, &options, &status);
+                if (!BFVM_CHECK(program && status == BFC_COMPILE_OK))
+                {
+                    continue;
+                }
+
+                for (size_t e = 0; e < sizeof(s_EofModes) / sizeof(s_EofModes[0]); e++)
+                {
+                    BFTestBuffer expected;
+                    const BFRunStatus expectedStatus = bfvmEngineTestRun(program, BFVM_ENGINE_SWITCH, s_EofModes[e], &expected);
+
+                    for (size_t i = 0; i < sizeof(s_Engines) / sizeof(s_Engines[0]); i++)
+                    {
+                        BFTestBuffer output;
+                        const BFRunStatus runStatus = bfvmEngineTestRun(program, s_Engines[i], s_EofModes[e], &output);
+                        if (!BFVM_CHECK(runStatus == expectedStatus && bfvmTestSameBuffer(&output, &expected)))
+                        {
+                            fprintf(stderr, "  %s at -O%d, %u-bit cells, EOF mode %d, engine %d\n",
+                                    test->name, (int)s_Levels[l], (unsigned)s_CellBits[c], (int)s_EofModes[e], (int)s_Engines[i]);
+                        }
+
+                        bfvmTestFreeBuffer(&output);
+                    }
+
+                    bfvmTestFreeBuffer(&expected);
+                }
+
+                bfcFreeProgram(program);
+            }
+        }
+
+        bfvmTestFreeBuffer(&source);
+    }
+
+    return bfvmTestResult();
+}
+
+static BFRunStatus bfvmEngineTestRun(const BFProgram *program, BFEngine engine, BFEofMode eof, BFTestBuffer *output)
+{
+    BFTestBuffer input;
+    bfvmTestInitBuffer(&input, s_Input, sizeof(s_Input) - 1);
+    bfvmTestInitBuffer(output, NULL, 0);
+
+    BFRunOptions options;
+    bfvmDefaultOptions(&options);
+    options.engine = engine;
+    options.fuel = BFVM_TEST_FUEL;
+    options.eof = eof;
+    options.read = bfvmTestRead;
+    options.readContext = &input;
+    options.write = bfvmTestWrite;
+    options.writeContext = output;
+
+    BFRunStatus status = BFVM_RUN_OUT_OF_MEMORY;
+    BFVirtualMachine *const vm = bfvmCreateSharedVirtualMachine(program, NULL, &options);
+    if (BFVM_CHECK(vm != NULL))
+    {
+        status = bfvmRunVirtualMachine(vm);
+        bfvmCloseVirtualMachine(vm);
+    }
+
+    bfvmTestFreeBuffer(&input);
+    return status;
+}
@@ -0,0 +1,187 @@
+/*
+ * Bytecode images have to come back as the program that was saved, and a
+ * truncated or corrupted image has to be rejected when it is loaded, or at
+ * worst run like any other program: never crash the virtual machine.
+ */
+#include "test.h"
+
+#include "core/memory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BFVM_TEST_FUEL 100000ULL
+
+/* an image starts with its magic, version and byte order, see bfc/bytecode/image.h */
+#define BFVM_TEST_IMAGE_TAG_SIZE (3 * sizeof(u32))
+
+static const char *const s_Programs[] = { "hello.b", "beer.b", "bitwidth.b", "sierpinski.b" };
+static const u8 s_CellBits[] = { 8, 16, 32 };
+static const BFOptLevel s_Levels[] = { BFC_OPT_NONE, BFC_OPT_PEEPHOLE, BFC_OPT_DATAFLOW };
+
+static void bfvmImageTestRoundTrip(const char *name, const BFTestBuffer *source, BFOptLevel level, u8 cellBits);
+static void bfvmImageTestTruncated(const char *imagePath, const BFTestBuffer *image);
+static void bfvmImageTestCorrupted(const char *imagePath, const BFTestBuffer *image);
+static BFBool bfvmImageTestSame(const BFProgram *a, const BFProgram *b);
+static BFRunStatus bfvmImageTestRun(const BFProgram *program, BFTestBuffer *output);
+
+int main(void)
+{
+    for (size_t p = 0; p < sizeof(s_Programs) / sizeof(s_Programs[0]); p++)
+    {
+        char *const path = bfvmTestSourcePath(s_Programs[p]);
+        BFTestBuffer source;
+        BFVM_CHECK(bfvmTestReadFile(path, &source));
+        BFVM_FREE(path);
+
+        for (size_t l = 0; l < sizeof(s_Levels) / sizeof(s_Levels[0]); l++)
+        {
+            for (size_t c = 0; c < sizeof(s_CellBits) / sizeof(s_CellBits[0]); c++)
+            {
+                bfvmImageTestRoundTrip(s_Programs[p], &source, s_Levels[l], s_CellBits[c]);
+            }
+        }
+
+        bfvmTestFreeBuffer(&source);
+    }
+
+    return bfvmTestResult();
+}
+
+/* hello.b is small enough to cut and corrupt at every byte */
+static void bfvmImageTestRoundTrip(const char *name, const BFTestBuffer *source, BFOptLevel level, u8 cellBits)
+{
+    const BFCompileOptions options = { level, cellBits, NULL, BF_FALSE, BFC_DEFAULT_PREFIX_STEPS, NULL };
+    BFProgram *const program = bfcCompileSource(name, (const char *)source->data, source->size, &options, NULL);
+    if (!BFVM_CHECK(program != NULL))
+    {
+        return;
+    }
+
+    char *const imagePath = bfvmTestOutputPath("image_test" BFC_BYTECODE_EXTENSION);
+    BFVM_CHECK(bfcSaveProgram(program, imagePath));
+
+    BFCompileStatus status = BFC_COMPILE_OK;
+    BFProgram *const loaded = bfcLoadProgram(imagePath, &status);
+    if (BFVM_CHECK(loaded != NULL && status == BFC_COMPILE_OK))
+    {
+        BFVM_CHECK(bfvmImageTestSame(program, loaded));
+
+        BFTestBuffer expected;
+        BFTestBuffer output;
+        BFVM_CHECK(bfvmImageTestRun(program, &expected) == bfvmImageTestRun(loaded, &output));
+        BFVM_CHECK(bfvmTestSameBuffer(&expected, &output));
+        bfvmTestFreeBuffer(&expected);
+        bfvmTestFreeBuffer(&output);
+        bfcFreeProgram(loaded);
+    }
+
+    BFTestBuffer image;
+    if (strcmp(name, "hello.b") == 0 && BFVM_CHECK(bfvmTestReadFile(imagePath, &image)))
+    {
+        bfvmImageTestTruncated(imagePath, &image);
+        bfvmImageTestCorrupted(imagePath, &image);
+        bfvmTestFreeBuffer(&image);
+    }
+
+    remove(imagePath);
+    BFVM_FREE(imagePath);
+    bfcFreeProgram(program);
+}
+
+static void bfvmImageTestTruncated(const char *imagePath, const BFTestBuffer *image)
+{
+    for (size_t size = 0; size < image->size; size++)
+    {
+        BFVM_CHECK(bfvmTestWriteFile(imagePath, image->data, size));
+
+        BFCompileStatus status = BFC_COMPILE_OK;
+        BFProgram *const program = bfcLoadProgram(imagePath, &status);
+        if (!BFVM_CHECK(program == NULL && status == BFC_COMPILE_INVALID_BYTECODE))
+        {
+            fprintf(stderr, "  image cut to %zu of %zu bytes was loaded\n", size, image->size);
+            bfcFreeProgram(program);
+        }
+    }
+}
+
+/*
+ * A broken header is always rejected. Broken code or prefix may happen to
+ * still be a valid program, so all that is asked of those is that loading
+ * and running them comes back.
+ */
+static void bfvmImageTestCorrupted(const char *imagePath, const BFTestBuffer *image)
+{
+    static const u8 s_Patterns[] = { 0x01, 0x80, 0xFF };
+
+    u8 *const bytes = BFVM_MALLOC(u8, image->size);
+    for (size_t i = 0; i < image->size; i++)
+    {
+        for (size_t p = 0; p < sizeof(s_Patterns); p++)
+        {
+            memcpy(bytes, image->data, image->size);
+            bytes[i] ^= s_Patterns[p];
+            BFVM_CHECK(bfvmTestWriteFile(imagePath, bytes, image->size));
+
+            BFProgram *const program = bfcLoadProgram(imagePath, NULL);
+            if (i < BFVM_TEST_IMAGE_TAG_SIZE && !BFVM_CHECK(program == NULL))
+            {
+                fprintf(stderr, "  image with byte %zu of its header flipped was loaded\n", i);
+            }
+
+            if (program)
+            {
+                BFTestBuffer output;
+                bfvmImageTestRun(program, &output);
+                bfvmTestFreeBuffer(&output);
+                bfcFreeProgram(program);
+            }
+        }
+    }
+
+    BFVM_FREE(bytes);
+}
+
+static BFBool bfvmImageTestSame(const BFProgram *a, const BFProgram *b)
+{
+    const size_t tapeBytes = a->prefixCells * (a->cellBits / 8);
+    return a->size == b->size
+        && a->cellBits == b->cellBits
+        && memcmp(a->code, b->code, (a->size + 1) * sizeof(BFOpCode)) == 0
+        && a->minOffset == b->minOffset
+        && a->maxOffset == b->maxOffset
+        && a->reach == b->reach
+        && a->prefixIp == b->prefixIp
+        && a->prefixDp == b->prefixDp
+        && a->prefixSpan == b->prefixSpan
+        && a->prefixEdges == b->prefixEdges
+        && a->prefixCells == b->prefixCells
+        && (tapeBytes == 0 || memcmp(a->prefixTape, b->prefixTape, tapeBytes) == 0)
+        && a->prefixOutputSize == b->prefixOutputSize
+        && (a->prefixOutputSize == 0 || memcmp(a->prefixOutput, b->prefixOutput, a->prefixOutputSize) == 0);
+}
+
+static BFRunStatus bfvmImageTestRun(const BFProgram *program, BFTestBuffer *output)
+{
+    BFTestBuffer input;
+    bfvmTestInitBuffer(&input, NULL, 0);
+    bfvmTestInitBuffer(output, NULL, 0);
+
+    BFRunOptions options;
+    bfvmDefaultOptions(&options);
+    options.fuel = BFVM_TEST_FUEL;
+    options.read = bfvmTestRead;
+    options.readContext = &input;
+    options.write = bfvmTestWrite;
+    options.writeContext = output;
+
+    BFRunStatus status = BFVM_RUN_OUT_OF_MEMORY;
+    BFVirtualMachine *const vm = bfvmCreateSharedVirtualMachine(program, NULL, &options);
+    if (BFVM_CHECK(vm != NULL))
+    {
+        status = bfvmRunVirtualMachine(vm);
+        bfvmCloseVirtualMachine(vm);
+    }
+
+    return status;
+}
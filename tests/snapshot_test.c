@@ -0,0 +1,300 @@
+#if !defined(_DEFAULT_SOURCE)
+#   define _DEFAULT_SOURCE
+#endif
+
+/*
+ * A run stopped for lack of fuel, saved to a snapshot and restored into a
+ * fresh virtual machine has to go on to the same output as an uninterrupted
+ * run. A truncated snapshot has to be rejected, and so does one whose header
+ * does not fit the program; corrupted cells may be restored, but the run
+ * must not crash.
+ */
+#include "test.h"
+
+#include "core/memory.h"
+#include "vm/snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BFVM_TEST_FUEL 100000ULL
+
+/* slice is the fuel of one run between snapshots */
+typedef struct BFSnapshotTestProgram
+{
+    const char *name;
+    const char *source;
+    u64         slice;
+} BFSnapshotTestProgram;
+
+/*
+ * File names are read from the tests directory, the rest are the source
+ * itself. They are compiled without optimizations or a prefix, so that every
+ * loop of theirs runs and burns fuel. Reading past the input gives a zero,
+ * which stops repeat.
+ */
+static const BFSnapshotTestProgram s_Programs[] = {
+    { "beer.b",       NULL,          50000 },
+    { "sierpinski.b", NULL,          10000 },
+    { "repeat",       ",[.>+[+]<,]", 1000  }
+};
+
+static const char s_Input[] = "Snapshots have to pick up where the run stopped.\n";
+
+static BFVirtualMachine *bfvmSnapshotTestCreate(const BFProgram *program, BFTestBuffer *input, BFTestBuffer *output, u64 fuel);
+static void bfvmSnapshotTestResume(const BFProgram *program, const char *snapshotPath, u64 slice);
+static void bfvmSnapshotTestTruncated(const BFProgram *program, const char *snapshotPath);
+static void bfvmSnapshotTestHeader(const BFProgram *program, const char *snapshotPath);
+static void bfvmSnapshotTestCells(const BFProgram *program, const char *snapshotPath);
+static BFSnapshotStatus bfvmSnapshotTestRestore(const BFProgram *program, const char *snapshotPath, const u8 *bytes, size_t size);
+
+int main(void)
+{
+    char *const snapshotPath = bfvmTestOutputPath("snapshot_test" BFVM_SNAPSHOT_EXTENSION);
+
+    for (size_t p = 0; p < sizeof(s_Programs) / sizeof(s_Programs[0]); p++)
+    {
+        const BFSnapshotTestProgram *const test = &s_Programs[p];
+
+        BFTestBuffer source;
+        if (test->source)
+        {
+            bfvmTestInitBuffer(&source, test->source, strlen(test->source));
+        }
+        else
+        {
+            char *const path = bfvmTestSourcePath(test->name);
+            BFVM_CHECK(bfvmTestReadFile(path, &source));
+            BFVM_FREE(path);
+        }
+
+        const BFCompileOptions options = { BFC_OPT_NONE, BFC_DEFAULT_CELL_BITS, NULL, BF_FALSE, 0, NULL };
+        BFProgram *const program = bfcCompileSource(test->name, (const char *)source.data, source.size, &options, NULL);
+        if (BFVM_CHECK(program != NULL))
+        {
+            bfvmSnapshotTestResume(program, snapshotPath, test->slice);
+            bfvmSnapshotTestTruncated(program, snapshotPath);
+            bfvmSnapshotTestHeader(program, snapshotPath);
+            bfvmSnapshotTestCells(program, snapshotPath);
+            bfcFreeProgram(program);
+        }
+
+        bfvmTestFreeBuffer(&source);
+    }
+
+    remove(snapshotPath);
+    BFVM_FREE(snapshotPath);
+    return bfvmTestResult();
+}
+
+static BFVirtualMachine *bfvmSnapshotTestCreate(const BFProgram *program, BFTestBuffer *input, BFTestBuffer *output, u64 fuel)
+{
+    bfvmTestInitBuffer(input, s_Input, sizeof(s_Input) - 1);
+
+    BFRunOptions options;
+    bfvmDefaultOptions(&options);
+    options.fuel = fuel;
+    options.eof = BFVM_EOF_ZERO;
+    options.read = bfvmTestRead;
+    options.readContext = input;
+    options.write = bfvmTestWrite;
+    options.writeContext = output;
+
+    BFVirtualMachine *const vm = bfvmCreateSharedVirtualMachine(program, NULL, &options);
+    BFVM_CHECK(vm != NULL);
+    return vm;
+}
+
+/* every slice of fuel ends in a snapshot, saved in the background every other time */
+static void bfvmSnapshotTestResume(const BFProgram *program, const char *snapshotPath, u64 slice)
+{
+    BFTestBuffer input;
+    BFTestBuffer expected;
+    bfvmTestInitBuffer(&expected, NULL, 0);
+
+    BFVirtualMachine *vm = bfvmSnapshotTestCreate(program, &input, &expected, 0);
+    if (!vm)
+    {
+        return;
+    }
+
+    BFVM_CHECK(bfvmRunVirtualMachine(vm) == BFVM_RUN_OK);
+    bfvmCloseVirtualMachine(vm);
+    bfvmTestFreeBuffer(&input);
+
+    BFTestBuffer output;
+    bfvmTestInitBuffer(&output, NULL, 0);
+
+    BFRunStatus status = BFVM_RUN_OUT_OF_FUEL;
+    for (size_t i = 0; status == BFVM_RUN_OUT_OF_FUEL; i++)
+    {
+        vm = bfvmSnapshotTestCreate(program, &input, &output, slice);
+        if (!vm)
+        {
+            break;
+        }
+
+        if (i > 0)
+        {
+            BFVM_CHECK(bfvmRestoreSnapshot(vm, snapshotPath) == BFVM_SNAPSHOT_OK);
+        }
+
+        status = bfvmRunVirtualMachine(vm);
+        if (status == BFVM_RUN_OUT_OF_FUEL)
+        {
+            BFVM_CHECK(bfvmSaveSnapshot(vm, snapshotPath, (i % 2) ? BF_TRUE : BF_FALSE));
+            BFVM_CHECK(bfvmWaitSnapshot(vm));
+        }
+
+        bfvmCloseVirtualMachine(vm);
+        bfvmTestFreeBuffer(&input);
+    }
+
+    BFVM_CHECK(status == BFVM_RUN_OK);
+    BFVM_CHECK(bfvmTestSameBuffer(&output, &expected));
+    bfvmTestFreeBuffer(&output);
+    bfvmTestFreeBuffer(&expected);
+}
+
+/* cut at every byte, including right after the header and before the end of the last run */
+static void bfvmSnapshotTestTruncated(const BFProgram *program, const char *snapshotPath)
+{
+    BFTestBuffer snapshot;
+    if (!BFVM_CHECK(bfvmTestReadFile(snapshotPath, &snapshot)))
+    {
+        return;
+    }
+
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_OK);
+
+    for (size_t size = 0; size < snapshot.size; size++)
+    {
+        const BFSnapshotStatus status = bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, size);
+        if (!BFVM_CHECK(status == BFVM_SNAPSHOT_INVALID))
+        {
+            fprintf(stderr, "  snapshot cut to %zu of %zu bytes: %s\n", size, snapshot.size, bfvmSnapshotStatusMessage(status));
+        }
+    }
+
+    bfvmTestWriteFile(snapshotPath, snapshot.data, snapshot.size);
+    bfvmTestFreeBuffer(&snapshot);
+}
+
+static void bfvmSnapshotTestHeader(const BFProgram *program, const char *snapshotPath)
+{
+    BFTestBuffer snapshot;
+    if (!BFVM_CHECK(bfvmTestReadFile(snapshotPath, &snapshot) && snapshot.size > sizeof(BFSnapshotHeader)))
+    {
+        return;
+    }
+
+    BFSnapshotHeader *const header = (BFSnapshotHeader *)snapshot.data;
+    const BFSnapshotHeader saved = *header;
+
+    header->magic ^= 1;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_INVALID);
+    *header = saved;
+
+    header->version++;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_INVALID);
+    *header = saved;
+
+    header->program ^= 1;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_OTHER_PROGRAM);
+    *header = saved;
+
+    header->cellBits = 16;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_OTHER_PROGRAM);
+    *header = saved;
+
+    header->tapeSize = (u64)1 << 40;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_TAPE_TOO_SMALL);
+    *header = saved;
+
+    header->tapeSize = 0;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_TAPE_TOO_SMALL);
+    *header = saved;
+
+    header->ip = program->size + 1;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_INVALID);
+    *header = saved;
+
+    header->dp = header->tapeSize;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_INVALID);
+    *header = saved;
+
+    header->input = sizeof(s_Input);
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_INPUT_TOO_SHORT);
+    *header = saved;
+
+    /* a run reaching past the end of the tape */
+    BFSnapshotRun *const run = (BFSnapshotRun *)(header + 1);
+    const u64 skip = run->skip;
+    run->skip = header->tapeSize;
+    BFVM_CHECK(bfvmSnapshotTestRestore(program, snapshotPath, snapshot.data, snapshot.size) == BFVM_SNAPSHOT_INVALID);
+    run->skip = skip;
+
+    bfvmTestWriteFile(snapshotPath, snapshot.data, snapshot.size);
+    bfvmTestFreeBuffer(&snapshot);
+}
+
+/* any cell values are a tape the program could have made */
+static void bfvmSnapshotTestCells(const BFProgram *program, const char *snapshotPath)
+{
+    BFTestBuffer snapshot;
+    if (!BFVM_CHECK(bfvmTestReadFile(snapshotPath, &snapshot)))
+    {
+        return;
+    }
+
+    const size_t first = sizeof(BFSnapshotHeader) + sizeof(BFSnapshotRun);
+    const size_t last = snapshot.size - sizeof(BFSnapshotRun);
+    const BFSnapshotRun *const run = (const BFSnapshotRun *)(snapshot.data + sizeof(BFSnapshotHeader));
+
+    for (size_t i = first; i < last && i < first + run->count; i++)
+    {
+        BFTestBuffer input;
+        BFTestBuffer output;
+        bfvmTestInitBuffer(&output, NULL, 0);
+
+        snapshot.data[i] ^= 0xFF;
+        BFVirtualMachine *const vm = bfvmSnapshotTestCreate(program, &input, &output, BFVM_TEST_FUEL);
+        if (vm)
+        {
+            BFVM_CHECK(bfvmTestWriteFile(snapshotPath, snapshot.data, snapshot.size));
+            if (BFVM_CHECK(bfvmRestoreSnapshot(vm, snapshotPath) == BFVM_SNAPSHOT_OK))
+            {
+                bfvmRunVirtualMachine(vm);
+            }
+
+            bfvmCloseVirtualMachine(vm);
+        }
+
+        snapshot.data[i] ^= 0xFF;
+        bfvmTestFreeBuffer(&input);
+        bfvmTestFreeBuffer(&output);
+    }
+
+    bfvmTestWriteFile(snapshotPath, snapshot.data, snapshot.size);
+    bfvmTestFreeBuffer(&snapshot);
+}
+
+static BFSnapshotStatus bfvmSnapshotTestRestore(const BFProgram *program, const char *snapshotPath, const u8 *bytes, size_t size)
+{
+    BFTestBuffer input;
+    BFTestBuffer output;
+    bfvmTestInitBuffer(&output, NULL, 0);
+
+    BFSnapshotStatus status = BFVM_SNAPSHOT_UNREADABLE;
+    BFVirtualMachine *const vm = bfvmSnapshotTestCreate(program, &input, &output, BFVM_TEST_FUEL);
+    if (vm)
+    {
+        BFVM_CHECK(bfvmTestWriteFile(snapshotPath, bytes, size));
+        status = bfvmRestoreSnapshot(vm, snapshotPath);
+        bfvmCloseVirtualMachine(vm);
+    }
+
+    bfvmTestFreeBuffer(&input);
+    bfvmTestFreeBuffer(&output);
+    return status;
+}
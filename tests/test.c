@@ -0,0 +1,143 @@
+#include "test.h"
+
+#include "core/memory.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static size_t s_Failures = 0;
+
+static char *bfvmTestJoin(const char *dir, const char *name);
+
+BFBool bfvmTestCheck(BFBool passed, const char *expr, const char *file, int line)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+        s_Failures++;
+    }
+
+    return passed;
+}
+
+int bfvmTestResult(void)
+{
+    if (s_Failures > 0)
+    {
+        fprintf(stderr, "%zu checks failed\n", s_Failures);
+        return 1;
+    }
+
+    return 0;
+}
+
+char *bfvmTestSourcePath(const char *name)
+{
+    return bfvmTestJoin(BFVM_TEST_SOURCE_DIR, name);
+}
+
+char *bfvmTestOutputPath(const char *name)
+{
+    return bfvmTestJoin(BFVM_TEST_OUTPUT_DIR, name);
+}
+
+BFBool bfvmTestReadFile(const char *filepath, BFTestBuffer *buffer)
+{
+    bfvmTestInitBuffer(buffer, NULL, 0);
+
+    FILE *const file = fopen(filepath, "rb");
+    if (!file)
+    {
+        return BF_FALSE;
+    }
+
+    u8 chunk[4096];
+    size_t count = 0;
+    while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        bfvmTestWrite(buffer, chunk, count);
+    }
+
+    const BFBool read = !ferror(file);
+    fclose(file);
+    return read;
+}
+
+BFBool bfvmTestWriteFile(const char *filepath, const u8 *data, size_t size)
+{
+    FILE *const file = fopen(filepath, "wb");
+    if (!file)
+    {
+        return BF_FALSE;
+    }
+
+    const BFBool written = size == 0 || fwrite(data, 1, size, file) == size;
+    return (fclose(file) == 0 && written) ? BF_TRUE : BF_FALSE;
+}
+
+void bfvmTestInitBuffer(BFTestBuffer *buffer, const void *data, size_t size)
+{
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+    buffer->pos = 0;
+    bfvmTestWrite(buffer, (const u8 *)data, size);
+}
+
+void bfvmTestFreeBuffer(BFTestBuffer *buffer)
+{
+    BFVM_FREE(buffer->data);
+    bfvmTestInitBuffer(buffer, NULL, 0);
+}
+
+BFBool bfvmTestSameBuffer(const BFTestBuffer *a, const BFTestBuffer *b)
+{
+    return (a->size == b->size && (a->size == 0 || memcmp(a->data, b->data, a->size) == 0)) ? BF_TRUE : BF_FALSE;
+}
+
+long bfvmTestRead(void *context, u8 *buffer, size_t size)
+{
+    BFTestBuffer *const input = (BFTestBuffer *)context;
+    const size_t left = input->size - input->pos;
+    const size_t count = (size < left) ? size : left;
+
+    if (count > 0)
+    {
+        memcpy(buffer, input->data + input->pos, count);
+        input->pos += count;
+    }
+
+    return (long)count;
+}
+
+BFBool bfvmTestWrite(void *context, const u8 *data, size_t size)
+{
+    BFTestBuffer *const output = (BFTestBuffer *)context;
+    if (size == 0)
+    {
+        return BF_TRUE;
+    }
+
+    if (output->size + size > output->capacity)
+    {
+        while (output->size + size > output->capacity)
+        {
+            output->capacity = (output->capacity > 0) ? output->capacity * 2 : 4096;
+        }
+
+        output->data = BFVM_REALLOC(u8, output->data, output->capacity);
+    }
+
+    memcpy(output->data + output->size, data, size);
+    output->size += size;
+    return BF_TRUE;
+}
+
+static char *bfvmTestJoin(const char *dir, const char *name)
+{
+    const size_t length = strlen(dir) + strlen(name) + 2;
+    char *const path = BFVM_MALLOC(char, length);
+    snprintf(path, length, "%s/%s", dir, name);
+
+    return path;
+}
@@ -0,0 +1,39 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "vm/bfvm.h"
+
+/*
+ * What the test programs share. A failed check prints where it is and the
+ * test goes on, so one run reports every failure; main returns
+ * bfvmTestResult at the end. Files are read from BFVM_TEST_SOURCE_DIR and
+ * written to BFVM_TEST_OUTPUT_DIR, both set by the build.
+ */
+#define BFVM_CHECK(EXPR) bfvmTestCheck((EXPR) ? BF_TRUE : BF_FALSE, #EXPR, __FILE__, __LINE__)
+
+/* bytes a program reads, from pos on, or that it has written */
+typedef struct BFTestBuffer
+{
+    u8     *data;
+    size_t  size;
+    size_t  capacity;
+    size_t  pos;
+} BFTestBuffer;
+
+BFBool bfvmTestCheck(BFBool passed, const char *expr, const char *file, int line);
+int bfvmTestResult(void);
+
+char *bfvmTestSourcePath(const char *name);
+char *bfvmTestOutputPath(const char *name);
+
+BFBool bfvmTestReadFile(const char *filepath, BFTestBuffer *buffer);
+BFBool bfvmTestWriteFile(const char *filepath, const u8 *data, size_t size);
+
+void bfvmTestInitBuffer(BFTestBuffer *buffer, const void *data, size_t size);
+void bfvmTestFreeBuffer(BFTestBuffer *buffer);
+BFBool bfvmTestSameBuffer(const BFTestBuffer *a, const BFTestBuffer *b);
+
+long bfvmTestRead(void *context, u8 *buffer, size_t size);
+BFBool bfvmTestWrite(void *context, const u8 *data, size_t size);
+
+#endif /* TEST_H */